@@ -0,0 +1,212 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "analysis.hpp"
+#include "constants.hpp"
+
+// Marks segments and loops that do not exist.
+constexpr size_t NONE = SIZE_MAX;
+
+Analysis::Analysis(const std::string &source) : _tapeSize(0) {
+  scan(source);
+  prove();
+}
+
+void Analysis::scan(const std::string &source) {
+  // The loop we are in, the segment we are in, and where we are relative
+  // to the origin: the last segment that starts where the pointer was known.
+  // The segment we are in starts at offset from there.
+  // Whether the loop does I/O, at any depth.
+  struct Frame {
+    size_t loop;
+    size_t segment;
+    int64_t offset;
+    size_t origin;
+    int64_t start;
+    bool io;
+  };
+  auto open = [this](Kind kind, size_t loop, size_t parent, int64_t offset) {
+    _segments.push_back({kind, {0, 0}, false, loop, parent, offset, false});
+    return _segments.size() - 1;
+  };
+  auto access = [this](const Frame &frame) {
+    Segment &segment = _segments[frame.segment];
+    int64_t offset = frame.offset - frame.start;
+    if (!segment.any) {
+      segment.range = {offset, offset};
+      segment.any = true;
+    } else {
+      segment.range.low = std::min(segment.range.low, offset);
+      segment.range.high = std::max(segment.range.high, offset);
+    }
+  };
+
+  size_t start = open(Kind::Start, NONE, NONE, 0);
+  std::vector<Frame> frames = {{NONE, start, 0, start, 0, false}};
+  for (size_t position = 0; position < source.size(); position++) {
+    Frame &frame = frames.back();
+    switch (source[position]) {
+      case '+':
+      case '-':
+        access(frame);
+        break;
+      case '.':
+      case ',': {
+        access(frame);
+        size_t after = open(Kind::Io, NONE, frame.segment,
+                            frame.offset - frame.start);
+        _io.emplace_back(position, after);
+        frame.segment = after;
+        frame.start = frame.offset;
+        frame.io = true;
+        break;
+      }
+      case '>':
+        frame.offset++;
+        break;
+      case '<':
+        frame.offset--;
+        break;
+      case '[': {
+        // The test happens in the enclosing segment.
+        access(frame);
+        size_t loop = _loops.size();
+        size_t body = open(Kind::Body, loop, frame.segment,
+                           frame.offset - frame.start);
+        _loops.push_back({false, body, NONE});
+        frames.push_back({loop, body, 0, body, 0, false});
+        break;
+      }
+      case ']': {
+        // Leave unmatched brackets to the compiler.
+        if (frames.size() == 1) {
+          break;
+        }
+        access(frame);
+        Loop &loop = _loops[frame.loop];
+        // A stride of zero needs to hold for every inner loop too.
+        loop.balanced = frame.origin == loop.body && frame.offset == 0;
+        bool io = frame.io;
+        frames.pop_back();
+        Frame &parent = frames.back();
+        parent.io = parent.io || io;
+        if (!loop.balanced) {
+          loop.exit = open(Kind::Exit, NONE, NONE, 0);
+          parent = {parent.loop, loop.exit, 0, loop.exit, 0, parent.io};
+        } else if (io) {
+          // What follows is only checked once the I/O in the loop is done.
+          loop.exit = open(Kind::Io, NONE, parent.segment,
+                           parent.offset - parent.start);
+          parent.segment = loop.exit;
+          parent.start = parent.offset;
+        }
+        break;
+      }
+    }
+  }
+}
+
+void Analysis::prove() {
+  // The offsets known to be in bounds at the start of each segment.
+  struct Interval {
+    bool known;
+    int64_t low;
+    int64_t high;
+  };
+  std::vector<Interval> proven(_segments.size());
+  // Where each segment starts on the tape, if every loop is balanced.
+  std::vector<int64_t> base(_segments.size());
+  bool bounded = true;
+  int64_t highest = -1;
+
+  // Segments only depend on the ones before them.
+  for (size_t i = 0; i < _segments.size(); i++) {
+    Segment &segment = _segments[i];
+    const Guard &range = segment.range;
+    Interval known = {false, 0, 0};
+    if (segment.kind == Kind::Start) {
+      known = {true, 0, static_cast<int64_t>(MEMORY_SIZE) - 1};
+    } else if ((segment.kind == Kind::Body && _loops[segment.loop].balanced)
+               || segment.kind == Kind::Io) {
+      // Every iteration starts at the same place, inside the parent, and I/O
+      // goes on from where it happened.
+      known = proven[segment.parent];
+      known.low -= segment.offset;
+      known.high -= segment.offset;
+      base[i] = base[segment.parent] + segment.offset;
+    } else {
+      bounded = false;
+    }
+
+    if (segment.any) {
+      highest = std::max(highest, base[i] + range.high);
+    }
+    if (!segment.any || (known.known && known.low <= range.low
+                         && range.high <= known.high)) {
+      proven[i] = known;
+      continue;
+    }
+    segment.checked = true;
+    // After the guard, both the guard and what was known before hold.
+    if (known.known && known.low <= range.high + 1
+        && range.low <= known.high + 1) {
+      proven[i] = {true, std::min(known.low, range.low),
+                   std::max(known.high, range.high)};
+    } else {
+      proven[i] = {true, range.low, range.high};
+    }
+  }
+  _tapeSize = bounded ? highest + 1 : 0;
+}
+
+const Guard* Analysis::guard(size_t segment) const {
+  if (segment >= _segments.size() || !_segments[segment].checked) {
+    return nullptr;
+  }
+  return &_segments[segment].range;
+}
+
+const Guard* Analysis::start() const {
+  return guard(0);
+}
+
+bool Analysis::balanced(size_t loop) const {
+  return loop < _loops.size() && _loops[loop].balanced;
+}
+
+const Guard* Analysis::body(size_t loop) const {
+  return loop < _loops.size() ? guard(_loops[loop].body) : nullptr;
+}
+
+const Guard* Analysis::exit(size_t loop) const {
+  return loop < _loops.size() ? guard(_loops[loop].exit) : nullptr;
+}
+
+const Guard* Analysis::io(uint64_t position) const {
+  auto found = std::lower_bound(_io.begin(), _io.end(),
+                                std::make_pair(position, size_t{0}));
+  if (found == _io.end() || found->first != position) {
+    return nullptr;
+  }
+  return guard(found->second);
+}
+
+size_t Analysis::tapeSize() const {
+  return _tapeSize;
+}
@@ -0,0 +1,124 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef analysis_hpp
+#define analysis_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "constants.hpp"
+
+// A bounds check: the offsets from the pointer that are about to be accessed.
+struct Guard {
+  int64_t low;
+  int64_t high;
+};
+
+// Every backend checks a guard the same way: everything is in bounds if
+// ptr + low, unsigned, is below this limit. A negative ptr + low wraps around
+// and fails the same comparison. Ranges that never fit get a limit of zero.
+inline uint64_t guardLimit(const Guard &range) {
+  int64_t span = range.high - range.low;
+  return span < static_cast<int64_t>(MEMORY_SIZE) ? MEMORY_SIZE - span : 0;
+}
+
+// Static pointer range analysis over the whole program.
+// The code is split into segments, each starting where the pointer is last
+// known: the start of the program, the start of a loop body, or right after a
+// loop with a non-zero stride. I/O starts a segment as well, and so does the
+// end of a loop with I/O inside, such that a guard never fails before output
+// that comes first. A segment runs until the next such point and covers the
+// accesses at its own depth, including the cells tested by [ and ].
+// One guard per segment replaces a check per access. Loops with a net stride
+// of zero are checked once on entry, or not at all if the offsets are already
+// proven in bounds; others are checked on every iteration.
+// Accesses that follow a loop are assumed to happen, so the guard in front of
+// a loop that never terminates may fire early.
+class Analysis {
+private:
+  enum class Kind : uint8_t {
+    Start, // The program start, the pointer is at zero.
+    Body,  // The start of a loop body.
+    Exit,  // After a loop with a non-zero stride.
+    Io,    // After a . or a ,, or a loop with one inside.
+  };
+
+  struct Segment {
+    Kind kind;
+    // The offsets accessed, relative to the start of the segment.
+    Guard range;
+    bool any;
+    // For a body: the loop, the enclosing segment and where in it we are.
+    // After I/O, the segment before and where in it the I/O happened.
+    size_t loop;
+    size_t parent;
+    int64_t offset;
+    // Filled in once all segments are known.
+    bool checked;
+  };
+
+  struct Loop {
+    bool balanced;
+    size_t body;
+    size_t exit;
+  };
+
+  std::vector<Segment> _segments;
+  std::vector<Loop> _loops;
+  // The segment after each . and ,, by the position of the command.
+  std::vector<std::pair<uint64_t, size_t>> _io;
+  size_t _tapeSize;
+
+  // Finds the segments and the offsets they access.
+  void scan(const std::string &source);
+
+  // Decides which segments need a guard.
+  void prove();
+
+  // The guard of a segment, nullptr if the accesses are proven.
+  const Guard* guard(size_t segment) const;
+
+public:
+  Analysis(const std::string &source);
+
+  // The guard before the first instruction.
+  const Guard* start() const;
+
+  // Whether the n-th loop of the program has a net stride of zero.
+  bool balanced(size_t loop) const;
+
+  // The guard at the start of the body of the n-th loop.
+  // For balanced loops this is only needed when entering the loop,
+  // for the others on every iteration.
+  const Guard* body(size_t loop) const;
+
+  // The guard after leaving the n-th loop, for non-balanced loops and for
+  // loops that do I/O.
+  const Guard* exit(size_t loop) const;
+
+  // The guard after the . or , at position in the source.
+  const Guard* io(uint64_t position) const;
+
+  // How many cells the program needs, 0 if that cannot be known statically.
+  size_t tapeSize() const;
+};
+
+#endif
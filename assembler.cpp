@@ -18,38 +18,133 @@
 
 #include <algorithm>
 #include <cassert>
-#include <sys/mman.h>
-#include <pthread.h>
+#include <thread>
 #include "assembler.hpp"
+#include "executable.hpp"
 
-Assembler::Assembler(uintmax_t heuristic) {
+Assembler::Assembler(uintmax_t heuristic, bool counting, bool fueled)
+  : _counting(counting), _outer(0u), _island(0u), _fueled(fueled),
+    _farChecks(0u) {
   // Reserve the heuristic so we don't have to alloc every time we write.
   _instructions.reserve(heuristic);
 
 }
 
 void* Assembler::assemble() {
-  // Create some executable memory.
   // Every instruction is 4 bytes.
-  uint64_t numBytes = _instructions.size() * sizeof(uint32_t);
-  void* rawAddress = mmap(nullptr,
-                          numBytes,
-                          PROT_READ | PROT_WRITE | PROT_EXEC,
-                          MAP_PRIVATE | MAP_ANON | MAP_JIT,
-                          -1,
-                          0);
-  if (__builtin_expect(rawAddress == MAP_FAILED, false)) {
-    return nullptr;
+  return mapExecutable(bytes(), [this](uint8_t* address) {
+    // Should be slightly faster than memcpy.
+    std::copy(_instructions.begin(), _instructions.end(),
+              reinterpret_cast<uint32_t*>(address));
+  });
+}
+
+Assembler Assembler::fragment(uintmax_t heuristic, size_t outer) const {
+  Assembler fragment(heuristic, _counting, _fueled);
+  fragment._outer = outer;
+  fragment._loops.resize(outer);
+  return fragment;
+}
+
+void Assembler::island() {
+  if (!_aborts.empty() || _farChecks < _fuelChecks.size()
+      || !_nearLoops.empty()) {
+    size_t over = bfar();
+    for (size_t abort : _aborts) {
+      size_t far = bfar();
+      patchBranch(abort, static_cast<int32_t>(far - abort));
+      _farAborts.push_back(far);
+    }
+    _aborts.clear();
+    for (; _farChecks < _fuelChecks.size(); _farChecks++) {
+      FuelCheck &check = _fuelChecks[_farChecks];
+      check.jump = bfar();
+      patchBranch(check.branch, static_cast<int32_t>(check.jump
+                                                     - check.branch));
+    }
+    for (size_t loop : _nearLoops) {
+      size_t far = bfar();
+      patchBranch(_loops[loop].first,
+                  static_cast<int32_t>(far - _loops[loop].first));
+      _loops[loop].first = far;
+    }
+    _nearLoops.clear();
+    patchBranch(over, static_cast<int32_t>(size() - over));
   }
-  // Allow JIT writing.
-  pthread_jit_write_protect_np(0);
-  // Should be slightly faster than memcpy.
-  std::copy(_instructions.begin(), _instructions.end(), reinterpret_cast<uint32_t*>(rawAddress));
-  // Disallow JIT writing again.
-  pthread_jit_write_protect_np(1);
-  // Clear instruction cache.
-  char* charAddress = reinterpret_cast<char*>(rawAddress);
-  __builtin___clear_cache(charAddress, charAddress + numBytes);
-  return rawAddress;
+  _island = size();
 }
 
+void Assembler::append(std::vector<Assembler> &fragments,
+                       const std::vector<std::vector<size_t>> &outer) {
+  // The targets of branches still waiting are at least a fragment away.
+  island();
+  std::vector<std::thread> islands;
+  for (Assembler &fragment : fragments) {
+    islands.emplace_back([&fragment]() { fragment.island(); });
+  }
+  for (std::thread &thread : islands) {
+    thread.join();
+  }
+
+  // Where everything of each fragment goes, and thus how far it moves.
+  struct Base {
+    size_t instructions;
+    size_t loops;
+    size_t aborts;
+    size_t fuelChecks;
+  };
+  std::vector<Base> bases;
+  Base end = {_instructions.size(), _loops.size(), _farAborts.size(),
+              _fuelChecks.size()};
+  for (const Assembler &fragment : fragments) {
+    bases.push_back(end);
+    end.instructions += fragment._instructions.size();
+    end.loops += fragment._loops.size() - fragment._outer;
+    end.aborts += fragment._farAborts.size();
+    end.fuelChecks += fragment._fuelChecks.size();
+  }
+  _instructions.resize(end.instructions);
+  _loops.resize(end.loops);
+  _farAborts.resize(end.aborts);
+  _fuelChecks.resize(end.fuelChecks);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < fragments.size(); i++) {
+    threads.emplace_back([&, i]() {
+      const Assembler &fragment = fragments[i];
+      const Base &base = bases[i];
+      std::copy(fragment._instructions.begin(), fragment._instructions.end(),
+                _instructions.begin() + base.instructions);
+      for (size_t loop = fragment._outer; loop < fragment._loops.size();
+           loop++) {
+        _loops[base.loops + loop - fragment._outer] = {
+          fragment._loops[loop].first + base.instructions,
+          fragment._loops[loop].second + base.instructions};
+      }
+      for (size_t abort = 0; abort < fragment._farAborts.size(); abort++) {
+        _farAborts[base.aborts + abort] = fragment._farAborts[abort]
+                                          + base.instructions;
+      }
+      for (size_t at = 0; at < fragment._fuelChecks.size(); at++) {
+        const FuelCheck &check = fragment._fuelChecks[at];
+        _fuelChecks[base.fuelChecks + at] = {
+          check.branch + base.instructions, check.jump + base.instructions,
+          check.resume + base.instructions, check.position};
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  _island = size();
+  _farChecks = _fuelChecks.size();
+
+  // Loops that span fragments are closed once all of them are in.
+  for (size_t i = 0; i < fragments.size(); i++) {
+    assert(outer[i].size() == fragments[i]._outer);
+    for (const auto &end : fragments[i]._outerEnds) {
+      const auto &loop = _loops[outer[i][end.first]];
+      patchLoop(loop.first, loop.second, end.second + bases[i].instructions);
+    }
+  }
+}
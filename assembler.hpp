@@ -19,44 +19,219 @@
 #ifndef assembler_hpp
 #define assembler_hpp
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
-#include <pthread.h>
+#include <utility>
 #include <vector>
+#include "analysis.hpp"
+#include "cells.hpp"
 #include "constants.hpp"
+#include "context.hpp"
 #include "register.hpp"
 
+// macOS traps with svc 0x80 and numbers its syscalls like BSD, Linux traps
+// with svc 0 and uses the generic numbers. See sys for where they go.
+#ifdef __APPLE__
+constexpr uint32_t SVC = 0xd4001001u;
+constexpr uint16_t SYSCALL_READ = 3;
+constexpr uint16_t SYSCALL_WRITE = 4;
+#else
+constexpr uint32_t SVC = 0xd4000001u;
+constexpr uint16_t SYSCALL_READ = 63;
+constexpr uint16_t SYSCALL_WRITE = 64;
+#endif
+
+// Conditional branches reach 2^18 instructions either way, 1 MiB.
+constexpr size_t BRANCH_REACH = 1 << 18;
+
+// Conditional branches still waiting for a target that may be further away
+// go through an island of unconditional branches, placed at least this often.
+constexpr size_t ISLAND_SPACING = 1 << 16;
+
 class Assembler {
 private:
   std::vector<uint32_t> _instructions;
+  // Whether I/O byte counters are kept and stored in the context.
+  bool _counting;
+  // Per loop: the branch at the start and where the body starts.
+  // The branch is a cbz, or the one in an island it goes through.
+  std::vector<std::pair<size_t, size_t>> _loops;
+  // The loops opened since the last island which are still open.
+  std::vector<size_t> _nearLoops;
+  // How many loops were opened before this fragment of the program, these
+  // come first in _loops but are only known once fragments are appended.
+  size_t _outer;
+  // The ends of those loops: which one, and the branch back into it.
+  std::vector<std::pair<size_t, size_t>> _outerEnds;
+  // Branches to the out of bounds exit, patched in the postlude.
+  // Those since the last island only reach so far, the ones before go
+  // through an unconditional branch in an island.
+  std::vector<size_t> _aborts;
+  std::vector<size_t> _farAborts;
+  // Where the last island ended.
+  size_t _island;
+  // Whether loop ends are charged fuel, kept in a register and the context.
+  bool _fueled;
+
+  // A loop end that may run out of fuel: the branch to its stub, where to
+  // resume, and the position of the ] in the source.
+  // The jump is the branch itself, or the one in an island it goes through.
+  struct FuelCheck {
+    size_t branch;
+    size_t jump;
+    size_t resume;
+    uint64_t position;
+  };
+  std::vector<FuelCheck> _fuelChecks;
+  // How many of those go through an island.
+  size_t _farChecks;
 
   inline void writeNext(uint32_t instr) {
     _instructions.push_back(instr); 
   }
 
+  // Places an island once the branches since the last one may not reach
+  // past here for much longer.
+  inline void keepInReach() {
+    if (__builtin_expect(_instructions.size() - _island >= ISLAND_SPACING,
+                         false)) {
+      island();
+    }
+  }
+
+  // Points the branches at the start and end of a loop at each other.
+  // The end is the cbnz, or the b that follows its inverse.
+  inline void patchLoop(size_t start, size_t body, size_t end) {
+    // However, we need the offsets in actual memory address.
+    // This is a bit useless because we will divide by 4 anyway, but it helps
+    // in the intermeditate processing.
+    // Forward: we jump to the instruction after.
+    int32_t deltaF = static_cast<int32_t>(end)
+                     - static_cast<int32_t>(start)
+                     + 1;
+    patchBranch(start, deltaF);
+    // Backward: we jump to the start of the body, past the entry guard.
+    int32_t deltaB = static_cast<int32_t>(body)
+                     - static_cast<int32_t>(end);
+    patchBranch(end, deltaB);
+  }
+
 public:
-  Assembler(uintmax_t heuristic);
+  Assembler(uintmax_t heuristic, bool counting = false, bool fueled = false);
   void* assemble();
 
+  // An assembler for a fragment of the program, which starts inside outer
+  // loops. Handles below outer stand for those, from the outermost.
+  Assembler fragment(uintmax_t heuristic, size_t outer) const;
+
+  // Appends fragments in order, each copied on its own thread.
+  // Their loops are numbered on from the loops here, one fragment after the
+  // other, and outer has the handles of the outer loops of each.
+  // Branches still waiting for their target get an island at the end of
+  // each fragment first.
+  void append(std::vector<Assembler> &fragments,
+              const std::vector<std::vector<size_t>> &outer);
+
+  // Gives every branch still waiting for its target an unconditional branch
+  // to go through instead, right here, which the code jumps over.
+  void island();
+
+  // How many loops have a handle, including outer ones.
+  inline size_t loops() const {
+    return _loops.size();
+  }
+
+  // The number of instructions written so far.
+  inline size_t size() const {
+    return _instructions.size();
+  }
+
+  // The size of the code written so far.
+  inline size_t bytes() const {
+    return _instructions.size() * sizeof(uint32_t);
+  }
+
+  // The size of the memory assemble maps, the code alone.
+  inline size_t mappedBytes() const {
+    return bytes();
+  }
+
   // The code that gets executed at the beginning of the subroutine.
   inline void prelude() {
     // The memory address of the memory is passed in x0.
     mov(memBase, x0);
-    // We want to zero the memory pointer.
-    mov(memPtr);
+    // The memory pointer starts where the host says, normally at zero.
+    sub(memPtr, x2, x0);
     // Set the up and down counters.
     // mov x11, #1
     writeNext(0xd280002b);
     // mov x12, #-1
     writeNext(0x9280000c);
+    // The context is passed in x1, but x1 gets clobbered by the syscalls.
+    mov(context, x1);
+    if (_counting) {
+      ldr(bytesOut, context, CONTEXT_BYTES_WRITTEN);
+      ldr(bytesIn, context, CONTEXT_BYTES_READ);
+    }
+    if (_fueled) {
+      ldr(fuelLeft, context, CONTEXT_FUEL);
+      // Go back to where the fuel ran out, if it did.
+      ldr(tmp1, context, CONTEXT_RESUME);
+      size_t start = cbzx(tmp1);
+      br(tmp1);
+      patchBranch(start, 2);
+    }
+  }
+
+  // Returns to the host with the given exit code.
+  inline void exit(uint16_t code) {
+    // Hand the counters back to the host.
+    if (_counting) {
+      str(bytesOut, context, CONTEXT_BYTES_WRITTEN);
+      str(bytesIn, context, CONTEXT_BYTES_READ);
+    }
+    if (_fueled) {
+      str(fuelLeft, context, CONTEXT_FUEL);
+    }
+    mov(x0, code);
+    // ret
+    writeNext(0xd65f03c0u);
   }
 
   // The code that gets executed at the end of the subroutine.
   inline void postlude() {
+    // The stubs below may be further away than a conditional branch reaches.
+    island();
     // Exit code 0.
-    mov(x0);
-    // ret
-    writeNext(0xd65f03c0u);
+    exit(0u);
+    // Failed guards end up here.
+    if (!_farAborts.empty()) {
+      size_t stub = _instructions.size();
+      exit(EXIT_OUT_OF_BOUNDS);
+      for (size_t abort : _farAborts) {
+        patchBranch(abort, static_cast<int32_t>(stub - abort));
+      }
+    }
+    // Loop ends that run out of fuel each record where, then leave together.
+    if (!_fuelChecks.empty()) {
+      size_t common = _instructions.size();
+      str(memPtr, context, CONTEXT_POINTER);
+      exit(EXIT_OUT_OF_FUEL);
+      for (const FuelCheck &check : _fuelChecks) {
+        patchBranch(check.jump,
+                    static_cast<int32_t>(_instructions.size() - check.jump));
+        mov64(tmp1, static_cast<int64_t>(check.position));
+        str(tmp1, context, CONTEXT_POSITION);
+        // The resume address is relative to here, adr alone may not reach.
+        size_t here = _instructions.size();
+        adr(tmp1);
+        mov64(tmp2, static_cast<int64_t>((here - check.resume) * 4));
+        sub(tmp1, tmp1, tmp2);
+        str(tmp1, context, CONTEXT_RESUME);
+        b(static_cast<int32_t>(common) - static_cast<int32_t>(size()));
+      }
+    }
   }
 
   // Move zero to register.
@@ -87,6 +262,30 @@ public:
     writeNext(instr);
   }
 
+  // Move any 64-bit immediate to register, in as few instructions as possible.
+  inline void mov64(const Register &dst, int64_t imm) {
+    // Negative numbers start from all ones instead of all zeros.
+    uint64_t fill = imm < 0 ? 0xffffu : 0u;
+    uint64_t bits = static_cast<uint64_t>(imm);
+    // mov x0, #0 or mov x0, #-1
+    uint32_t instr = imm < 0 ? 0x92800000u : 0xd2800000u;
+    instr |= dst.encode();
+    instr |= ((bits & 0xffffu) ^ fill) << 5;
+    writeNext(instr);
+    for (uint32_t hw = 1; hw < 4; hw++) {
+      uint64_t part = (bits >> (hw * 16)) & 0xffffu;
+      if (part == fill) {
+        continue;
+      }
+      // movk x0, #0, lsl #0
+      instr = 0xf2800000u;
+      instr |= dst.encode();
+      instr |= hw << 21;
+      instr |= part << 5;
+      writeNext(instr);
+    }
+  }
+
   // Load byte from memory, extend rest of register with zero.
   inline void ldrb(const Register &dst,
                    const Register &base,
@@ -114,6 +313,50 @@ public:
     writeNext(instr);
   }
 
+  // Substract two registers and place result into third register.
+  inline void sub(const Register &dst,
+                  const Register &left,
+                  const Register &right) {
+    // sub x0, x0, x0
+    uint32_t instr = 0xcb000000u;
+    instr |= dst.encode();
+    instr |= (left.encode() << 5);
+    instr |= (right.encode() << 16);
+    writeNext(instr);
+  }
+
+  // Load a register from a byte offset from the base, must be 8 aligned.
+  inline void ldr(const Register &dst, const Register &base, uint16_t off) {
+    assert(off % 8 == 0 && off / 8 <= ADD_SUB_IMM_LIMIT);
+    // ldr x0, [x0, #0]
+    uint32_t instr = 0xf9400000u;
+    instr |= dst.encode();
+    instr |= (base.encode() << 5);
+    // The immediate is scaled by the access size.
+    instr |= ((off / 8) << 10);
+    writeNext(instr);
+  }
+
+  // Move the address of this very instruction into the register.
+  inline void adr(const Register &dst) {
+    // adr x0, #0
+    uint32_t instr = 0x10000000u;
+    instr |= dst.encode();
+    writeNext(instr);
+  }
+
+  // Store a register at a byte offset from the base, must be 8 aligned.
+  inline void str(const Register &value, const Register &base, uint16_t off) {
+    assert(off % 8 == 0 && off / 8 <= ADD_SUB_IMM_LIMIT);
+    // str x0, [x0, #0]
+    uint32_t instr = 0xf9000000u;
+    instr |= value.encode();
+    instr |= (base.encode() << 5);
+    // The immediate is scaled by the access size.
+    instr |= ((off / 8) << 10);
+    writeNext(instr);
+  }
+
   // Add with immediate.
   inline void add(const Register &dst, const Register &src, uint16_t imm) {
     assert(imm <= ADD_SUB_IMM_LIMIT); // should fit [0, 4096).
@@ -142,19 +385,6 @@ public:
     writeNext(instr);
   }
 
-  // Add register value to value in memory address.
-  inline void ldaddb(const Register &addr, const Register &amt) {
-    // ldaddb w0, wzr, [x0]
-    uint32_t instr = 0x3820001fu;
-    // First register is how much we want to add.
-    instr |= (amt.encode() << 16);
-    // // Second register is the old value, we ignore.
-    // instr |= xzr_sp.encode();
-    // Third register is the address.
-    instr |= (addr.encode() << 5);
-    writeNext(instr);
-  }
-
   // Store a byte in the register at the specific address.
   inline void strb(const Register &value,
                    const Register &base,
@@ -169,6 +399,196 @@ public:
     writeNext(instr);
   }
 
+  // Load a byte at an unscaled offset in [-256, 256) from the base.
+  inline void ldurb(const Register &dst, const Register &base, int16_t off) {
+    assert(off >= -256 && off < 256);
+    // ldurb w0, [x0, #0]
+    uint32_t instr = 0x38400000u;
+    instr |= dst.encode();
+    instr |= (base.encode() << 5);
+    instr |= ((static_cast<uint32_t>(off) & 0x1ffu) << 12);
+    writeNext(instr);
+  }
+
+  // Store a byte at an unscaled offset in [-256, 256) from the base.
+  inline void sturb(const Register &value, const Register &base, int16_t off) {
+    assert(off >= -256 && off < 256);
+    // sturb w0, [x0, #0]
+    uint32_t instr = 0x38000000u;
+    instr |= value.encode();
+    instr |= (base.encode() << 5);
+    instr |= ((static_cast<uint32_t>(off) & 0x1ffu) << 12);
+    writeNext(instr);
+  }
+
+  // Load 16 bytes into a vector register, offset as with ldurb.
+  inline void ldurq(const Register &dst, const Register &base, int16_t off) {
+    assert(off >= -256 && off < 256);
+    // ldur q0, [x0, #0]
+    uint32_t instr = 0x3cc00000u;
+    instr |= dst.encode();
+    instr |= (base.encode() << 5);
+    instr |= ((static_cast<uint32_t>(off) & 0x1ffu) << 12);
+    writeNext(instr);
+  }
+
+  // Store 16 bytes from a vector register, offset as with ldurb.
+  inline void sturq(const Register &value, const Register &base, int16_t off) {
+    assert(off >= -256 && off < 256);
+    // stur q0, [x0, #0]
+    uint32_t instr = 0x3c800000u;
+    instr |= value.encode();
+    instr |= (base.encode() << 5);
+    instr |= ((static_cast<uint32_t>(off) & 0x1ffu) << 12);
+    writeNext(instr);
+  }
+
+  // Store 16 bytes from a vector register, then move the base past them.
+  inline void strqPost(const Register &value, const Register &base) {
+    // str q0, [x0], #16
+    uint32_t instr = 0x3c810400u;
+    instr |= value.encode();
+    instr |= (base.encode() << 5);
+    writeNext(instr);
+  }
+
+  // Move a register into the low half of a vector register, zero the rest.
+  inline void fmov(const Register &dst, const Register &src) {
+    // fmov d0, x0
+    uint32_t instr = 0x9e670000u;
+    instr |= dst.encode();
+    instr |= (src.encode() << 5);
+    writeNext(instr);
+  }
+
+  // Move a register into the high half of a vector register.
+  inline void insHigh(const Register &dst, const Register &src) {
+    // mov v0.d[1], x0
+    uint32_t instr = 0x4e181c00u;
+    instr |= dst.encode();
+    instr |= (src.encode() << 5);
+    writeNext(instr);
+  }
+
+  // Zero a vector register.
+  inline void movi(const Register &dst) {
+    // movi v0.2d, #0
+    uint32_t instr = 0x6f00e400u;
+    instr |= dst.encode();
+    writeNext(instr);
+  }
+
+  // Clear the bits of a vector register that are set in another one.
+  inline void bic(const Register &dst,
+                  const Register &left,
+                  const Register &right) {
+    // bic v0.16b, v0.16b, v0.16b
+    uint32_t instr = 0x4e601c00u;
+    instr |= dst.encode();
+    instr |= (left.encode() << 5);
+    instr |= (right.encode() << 16);
+    writeNext(instr);
+  }
+
+  // Add two vector registers bytewise, wrapping each byte.
+  inline void addv(const Register &dst,
+                   const Register &left,
+                   const Register &right) {
+    // add v0.16b, v0.16b, v0.16b
+    uint32_t instr = 0x4e208400u;
+    instr |= dst.encode();
+    instr |= (left.encode() << 5);
+    instr |= (right.encode() << 16);
+    writeNext(instr);
+  }
+
+  // Substract with immediate, setting the flags.
+  inline void subs(const Register &dst, const Register &src, uint16_t imm) {
+    assert(imm <= ADD_SUB_IMM_LIMIT); // should fit [0, 4096).
+    // subs x0, x0, #0
+    uint32_t instr = 0xf1000000u;
+    instr |= dst.encode();
+    instr |= (src.encode() << 5);
+    instr |= (imm << 10);
+    writeNext(instr);
+  }
+
+  // Compare two registers, setting the flags.
+  inline void cmp(const Register &left, const Register &right) {
+    // cmp x0, x0
+    uint32_t instr = 0xeb00001fu;
+    instr |= (left.encode() << 5);
+    instr |= (right.encode() << 16);
+    writeNext(instr);
+  }
+
+  // Branch if unsigned higher or same, i.e. the carry is set.
+  // Returns the location, such that the jump can be patched later.
+  inline size_t bhs() {
+    // b.hs #0
+    writeNext(0x54000002u);
+    return _instructions.size() - 1;
+  }
+
+  // Branch if the zero flag is not set.
+  // Returns the location, such that the jump can be patched later.
+  inline size_t bne() {
+    // b.ne #0
+    writeNext(0x54000001u);
+    return _instructions.size() - 1;
+  }
+
+  // Branch if the negative flag is set.
+  // Returns the location, such that the jump can be patched later.
+  inline size_t bmi() {
+    // b.mi #0
+    writeNext(0x54000004u);
+    return _instructions.size() - 1;
+  }
+
+  // Branch by a number of instructions, which is known already.
+  inline void b(int32_t indexDifference) {
+    assert(indexDifference >= -(1 << 25) && indexDifference < (1 << 25));
+    // b #0
+    uint32_t instr = 0x14000000u;
+    instr |= static_cast<uint32_t>(indexDifference) & ((1 << 26) - 1);
+    writeNext(instr);
+  }
+
+  // Branch always, 2^25 instructions either way.
+  // Returns the location, such that the jump can be patched later.
+  inline size_t bfar() {
+    // b #0
+    writeNext(0x14000000u);
+    return _instructions.size() - 1;
+  }
+
+  // Branch to the address in the register.
+  inline void br(const Register &target) {
+    // br x0
+    uint32_t instr = 0xd61f0000u;
+    instr |= (target.encode() << 5);
+    writeNext(instr);
+  }
+
+  // Branch if the whole 64-bit register is zero.
+  // Returns the location, such that the jump can be patched later.
+  inline size_t cbzx(const Register &reg) {
+    // cbz x0, #0
+    uint32_t instr = 0xb4000000u;
+    instr |= reg.encode();
+    writeNext(instr);
+    return _instructions.size() - 1;
+  }
+
+  // Branch always, with the same reach as the conditional branches.
+  // Returns the location, such that the jump can be patched later.
+  inline size_t bal() {
+    // b.al #0
+    writeNext(0x5400000eu);
+    return _instructions.size() - 1;
+  }
+
   // Branch if register is zero.
   // Returns the location, such that the jump can be patched later.
   inline size_t cbz(const Register &reg) {
@@ -192,49 +612,345 @@ public:
   }
 
   // Performs a branch patch given a location and offset (byte aligned).
+  // A b takes a 26-bit offset, the conditional branches a 19-bit one, which
+  // the offset has to fit.
   inline void patchBranch(size_t index, int32_t indexDifference) {
     uint32_t instr = _instructions[index];
-    // AArch64 expects the imm19 to be the address divided by 4.
+    bool far = (instr & 0xfc000000u) == 0x14000000u;
+    int bits = far ? 26 : 19;
+    assert(indexDifference >= -(1 << (bits - 1))
+           && indexDifference < (1 << (bits - 1)));
+    // AArch64 expects the immediate to be the address divided by 4.
     // Since we do indices, we do not have to do any processing.
-    uint32_t rel = indexDifference;
     // Mask the immediate.
     // This is necessary for negative numbers, not required for positive ones.
-    uint32_t toEncode = static_cast<uint32_t>(rel) & ((1 << 19) - 1);
-    instr |= (toEncode << 5);
+    uint32_t mask = (1u << bits) - 1;
+    uint32_t toEncode = static_cast<uint32_t>(indexDifference) & mask;
+    // Branches can be patched again, to go through an island instead.
+    int shift = far ? 0 : 5;
+    instr &= ~(mask << shift);
+    instr |= (toEncode << shift);
     _instructions[index] = instr;
   }
 
-  // Writes an svc 0x80.
+  // Adds a (wrapping) delta to the current cell.
+  inline void addCell(int8_t delta) {
+    // Not ldaddb, which is an LSE atomic that ARMv8.0 cores do not have.
+    ldrb(tmp1, memBase, memPtr);
+    // Only the low byte is stored, so the delta wraps as an unsigned one.
+    add(tmp1, tmp1, static_cast<uint8_t>(delta));
+    strb(tmp1, memBase, memPtr);
+  }
+
+  // Moves the memory pointer, in chunks if it does not fit an immediate.
+  inline void movePointer(int64_t delta) {
+    keepInReach();
+    uint64_t abs = delta < 0 ? -delta : delta;
+    uint64_t iters = abs / ADD_SUB_IMM_LIMIT, rem = abs % ADD_SUB_IMM_LIMIT;
+    for (uint64_t i = 0; i <= iters; i++) {
+      uint16_t imm = i < iters ? ADD_SUB_IMM_LIMIT : rem;
+      if (delta > 0) {
+        add(memPtr, memPtr, imm);
+      } else {
+        sub(memPtr, memPtr, imm);
+      }
+    }
+  }
+
+  // Sets the current cell, to zero this is what [-] does.
+  inline void setCell(uint8_t value) {
+    // Move the value to the address at the current memory address.
+    mov(tmp1, value);
+    strb(tmp1, memBase, memPtr);
+  }
+
+  // Adds any offset to a register, in as few instructions as possible.
+  inline void addOffset(const Register &dst, const Register &src,
+                        int64_t offset) {
+    if (offset >= 0 && offset <= ADD_SUB_IMM_LIMIT) {
+      add(dst, src, offset);
+    } else if (offset < 0 && -offset <= ADD_SUB_IMM_LIMIT) {
+      sub(dst, src, -offset);
+    } else {
+      mov64(dst, offset);
+      add(dst, src, dst);
+    }
+  }
+
+  // Whether an unscaled load or store from tmp1 reaches the offset.
+  static inline bool reaches(int64_t offset) {
+    return offset >= -256 && offset < 256;
+  }
+
+  // Builds 16 bytes, low half first, in a vector register.
+  inline void vectorConstant(const Register &dst, const uint64_t (&bytes)[2]) {
+    if (bytes[0] == 0 && bytes[1] == 0) {
+      movi(dst);
+      return;
+    }
+    if (bytes[0] == 0) {
+      fmov(dst, xzr_sp);
+    } else {
+      mov64(tmp2, static_cast<int64_t>(bytes[0]));
+      fmov(dst, tmp2);
+    }
+    if (bytes[1] != 0) {
+      mov64(tmp3, static_cast<int64_t>(bytes[1]));
+      insHigh(dst, tmp3);
+    }
+  }
+
+  // Changes a single cell at an offset from tmp1.
+  inline void updateCell(const CellUpdate &cell) {
+    int64_t off = cell.offset;
+    if (!reaches(off)) {
+      addOffset(tmp2, tmp1, off);
+    }
+    const Register &base = reaches(off) ? tmp1 : tmp2;
+    int16_t imm = reaches(off) ? off : 0;
+    if (cell.set && cell.value == 0) {
+      sturb(xzr_sp, base, imm);
+      return;
+    }
+    if (cell.set) {
+      mov(tmp3, cell.value);
+    } else {
+      ldurb(tmp3, base, imm);
+      add(tmp3, tmp3, cell.value);
+    }
+    sturb(tmp3, base, imm);
+  }
+
+  // Changes the cells from first up to end, which span less than a vector, at
+  // once: clear the ones that are set, then add to all of them.
+  inline void updateVector(const std::vector<CellUpdate> &cells,
+                           size_t first, size_t end) {
+    int64_t off = cells[first].offset;
+    uint64_t clear[2] = {0u, 0u};
+    uint64_t delta[2] = {0u, 0u};
+    size_t sets = 0;
+    for (size_t i = first; i < end; i++) {
+      size_t at = cells[i].offset - off;
+      uint32_t shift = (at % 8) * 8;
+      if (cells[i].set) {
+        clear[at / 8] |= 0xffull << shift;
+        sets++;
+      }
+      delta[at / 8] |= static_cast<uint64_t>(cells[i].value) << shift;
+    }
+    // When every cell is set, the old ones do not matter.
+    bool whole = sets == VECTOR_CELLS;
+    bool adds = delta[0] != 0 || delta[1] != 0;
+    // The constants go first, building them needs tmp2.
+    if (sets != 0 && !whole) {
+      vectorConstant(vecClear, clear);
+    }
+    if (adds || whole) {
+      vectorConstant(vecAdd, delta);
+    }
+    if (!reaches(off)) {
+      addOffset(tmp2, tmp1, off);
+    }
+    const Register &base = reaches(off) ? tmp1 : tmp2;
+    int16_t imm = reaches(off) ? off : 0;
+    if (whole) {
+      sturq(vecAdd, base, imm);
+      return;
+    }
+    ldurq(vecCells, base, imm);
+    if (sets != 0) {
+      bic(vecCells, vecCells, vecClear);
+    }
+    if (adds) {
+      addv(vecCells, vecCells, vecAdd);
+    }
+    sturq(vecCells, base, imm);
+  }
+
+  // Clears the given number of vectors from an offset from tmp1 in a loop.
+  inline void clearVectors(int64_t offset, uint64_t vectors) {
+    addOffset(tmp2, tmp1, offset);
+    mov64(tmp3, static_cast<int64_t>(vectors));
+    movi(vecCells);
+    size_t loop = _instructions.size();
+    strqPost(vecCells, tmp2);
+    subs(tmp3, tmp3, 1u);
+    size_t back = bne();
+    patchBranch(back, static_cast<int32_t>(loop) - static_cast<int32_t>(back));
+  }
+
+  // Applies the changes of a straight-line run, relative to the pointer.
+  // Cells less than a vector apart are changed together, long cleared runs
+  // in a loop, like memset.
+  inline void updateCells(const std::vector<CellUpdate> &cells) {
+    keepInReach();
+    // Only changing the current cell is best done in place.
+    if (cells.size() == 1 && cells[0].offset == 0) {
+      if (cells[0].set) {
+        setCell(cells[0].value);
+      } else {
+        addCell(cells[0].value);
+      }
+      return;
+    }
+    add(tmp1, memBase, memPtr);
+    size_t i = 0;
+    while (i < cells.size()) {
+      size_t zeros = zeroRun(cells, i);
+      if (zeros >= CLEAR_LOOP_CELLS) {
+        uint64_t vectors = zeros / VECTOR_CELLS;
+        clearVectors(cells[i].offset, vectors);
+        i += vectors * VECTOR_CELLS;
+        continue;
+      }
+      size_t end = i + 1;
+      while (end < cells.size() && cells[end].offset - cells[i].offset
+                                   < static_cast<int64_t>(VECTOR_CELLS)) {
+        end++;
+      }
+      if (end - i == 1) {
+        updateCell(cells[i]);
+      } else {
+        updateVector(cells, i, end);
+      }
+      i = end;
+    }
+  }
+
+  // Aborts unless the offsets from the pointer are in bounds.
+  inline void guard(const Guard &range) {
+    keepInReach();
+    uint64_t limit = guardLimit(range);
+    // Some ranges never fit.
+    if (limit == 0) {
+      _aborts.push_back(bal());
+      return;
+    }
+    addOffset(tmp1, memPtr, range.low);
+    mov64(tmp2, limit);
+    cmp(tmp1, tmp2);
+    _aborts.push_back(bhs());
+  }
+
+  // Opens a loop, returns what loopEnd needs to patch the branches.
+  // The guard, if any, only runs when entering the loop.
+  inline size_t loopStart(const Guard* once = nullptr) {
+    keepInReach();
+    ldrb(tmp1, memBase, memPtr);
+    size_t start = cbz(tmp1);
+    if (once != nullptr) {
+      guard(*once);
+    }
+    _loops.emplace_back(start, _instructions.size());
+    _nearLoops.push_back(_loops.size() - 1);
+    return _loops.size() - 1;
+  }
+
+  // Charges a loop iteration the static cost of its body, before the ] test.
+  // Running out goes to a stub which records the position and leaves.
+  inline void chargeFuel(uint64_t cost, uint64_t position) {
+    if (!_fueled) {
+      return;
+    }
+    // Bigger bodies are undercharged, fuel is a budget and not exact.
+    keepInReach();
+    uint16_t imm = std::min<uint64_t>(cost, ADD_SUB_IMM_LIMIT);
+    subs(fuelLeft, fuelLeft, imm);
+    size_t branch = bmi();
+    _fuelChecks.push_back({branch, branch, _instructions.size(), position});
+  }
+
+  // Closes the loop opened at loop.
+  // A body too long for a cbnz to reach, or in another fragment, is branched
+  // back to with a b, skipped by a cbz when the loop ends.
+  inline void loopEnd(size_t loop) {
+    keepInReach();
+    ldrb(tmp1, memBase, memPtr);
+    size_t end;
+    if (loop < _outer
+        || _instructions.size() - _loops[loop].second >= BRANCH_REACH) {
+      size_t skip = cbz(tmp1);
+      end = bfar();
+      patchBranch(skip, 2);
+    } else {
+      end = cbnz(tmp1);
+    }
+    if (!_nearLoops.empty() && _nearLoops.back() == loop) {
+      _nearLoops.pop_back();
+    }
+    if (loop < _outer) {
+      _outerEnds.emplace_back(loop, end);
+      return;
+    }
+    // The start and end points are in the program counter.
+    patchLoop(_loops[loop].first, _loops[loop].second, end);
+  }
+
+  // Sets what the fuel check before the ] at position charges.
+  inline void patchFuel(uint64_t position, uint64_t cost) {
+    for (auto check = _fuelChecks.rbegin(); check != _fuelChecks.rend();
+         check++) {
+      if (check->position == position) {
+        // The subs right before the branch.
+        uint32_t &instr = _instructions[check->branch - 1];
+        uint32_t imm = std::min<uint64_t>(cost, ADD_SUB_IMM_LIMIT);
+        instr = (instr & ~(0xfffu << 10)) | (imm << 10);
+        return;
+      }
+    }
+  }
+
+  // Writes the current cell to stdout.
+  inline void output() {
+    keepInReach();
+    syscallOut();
+  }
+
+  // Reads stdin into the current cell.
+  inline void input() {
+    keepInReach();
+    syscallIn();
+  }
+
+  // Writes an svc 0x80, or an svc 0 on Linux.
   inline void syscall() {
-     writeNext(0xd4001001u);
+     writeNext(SVC);
   }
 
   // Syscall to print a character out.
   inline void syscallOut() {
-    // mov x0, #1
+    // ldr x0, file descriptor
     // adr x1, address (here not relative)
     // mov x2, length
-    // mov x16, #4
-    // svc 0x80
-    mov(x0, 1u);
+    // mov x16, #4 (mov x8, #64)
+    // svc 0x80 (svc 0)
+    ldr(x0, context, CONTEXT_OUT_FD);
     add(x1, memBase, memPtr);
     mov(x2, constOne);
-    mov(sys, 4u);
+    mov(sys, SYSCALL_WRITE);
     syscall();
+    // The syscall returns how many bytes were written.
+    if (_counting) {
+      add(bytesOut, bytesOut, x0);
+    }
   }
 
   // Syscsall to read a character in.
   inline void syscallIn() {
-    // mov x0, #0
+    // ldr x0, file descriptor
     // adr x1, address (here not relative)
     // mov x2, length
-    // mov x16, #3
-    // svc 0x80
-    mov(x0, 0u);
+    // mov x16, #3 (mov x8, #63)
+    // svc 0x80 (svc 0)
+    ldr(x0, context, CONTEXT_IN_FD);
     add(x1, memBase, memPtr);
     mov(x2, constOne);
-    mov(sys, 3u);
+    mov(sys, SYSCALL_READ);
     syscall();
+    // The syscall returns how many bytes were read.
+    if (_counting) {
+      add(bytesIn, bytesIn, x0);
+    }
   }
 
 };
@@ -0,0 +1,81 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "assembler.hpp"
+#include "backend.hpp"
+#include "chunks.hpp"
+#include "compiler.hpp"
+#include "copypatch.hpp"
+
+bool parseBackendOption(const char* arg, BackendOptions &options,
+                        bool &invalid) {
+  invalid = false;
+  if (std::strcmp(arg, "--safe") == 0) {
+    options.safe = true;
+  } else if (std::strncmp(arg, "--fuel=", 7) == 0) {
+    options.fuel = std::strtoll(arg + 7, nullptr, 10);
+    if (options.fuel <= 0) {
+      std::cerr << "zero: fuel has to be positive" << std::endl;
+      invalid = true;
+    }
+  } else if (std::strcmp(arg, "--copy-patch") == 0) {
+    options.copyPatch = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+template <class Backend>
+static CompiledProgram compileWith(const std::string &source,
+                                   const Analysis* analysis, int64_t fuel,
+                                   bool counting, unsigned threads,
+                                   Stats &report) {
+  // Perform a heuristic estimation of how many instructions we will need.
+  // Estimate 1 Assembly instruction per real instruction.
+  PhaseTimer compileTimer;
+  uintmax_t heuristic = source.size();
+  // The I/O counters and fuel checks are only emitted when asked for.
+  Backend backend(heuristic, counting, fuel > 0);
+  std::vector<Chunk> chunks = splitChunks(source, threads);
+  translateChunks(backend, source, analysis, report, chunks);
+  compileTimer.stop(report.compile);
+
+  // Put everything into executable memory.
+  PhaseTimer assembleTimer;
+  void* baseAddress = backend.assemble();
+  assembleTimer.stop(report.assemble);
+  report.ops = backend.size();
+  report.codeBytes = backend.bytes();
+  return {reinterpret_cast<JitFunction>(baseAddress), backend.mappedBytes()};
+}
+
+CompiledProgram compileProgram(const std::string &source,
+                               const Analysis* analysis,
+                               const BackendOptions &options, bool counting,
+                               unsigned threads, Stats &report) {
+  return options.copyPatch
+         ? compileWith<CopyPatch>(source, analysis, options.fuel, counting,
+                                  threads, report)
+         : compileWith<Assembler>(source, analysis, options.fuel, counting,
+                                  threads, report);
+}
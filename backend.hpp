@@ -0,0 +1,64 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef backend_hpp
+#define backend_hpp
+
+#include <cstdint>
+#include <string>
+#include "analysis.hpp"
+#include "context.hpp"
+#include "stats.hpp"
+
+// The AArch64 backend only runs on AArch64, elsewhere copy the stencils.
+#ifdef __aarch64__
+constexpr bool DEFAULT_COPY_PATCH = false;
+#else
+constexpr bool DEFAULT_COPY_PATCH = true;
+#endif
+
+// How programs are compiled, the same for zero-jit and zero-serve.
+struct BackendOptions {
+  bool safe = false;
+  int64_t fuel = 0;
+  bool copyPatch = DEFAULT_COPY_PATCH;
+};
+
+// Parses --safe, --fuel=N and --copy-patch into options.
+// Returns false if the argument is none of them, or with an error message
+// if its value is invalid, in which case invalid is set.
+bool parseBackendOption(const char* arg, BackendOptions &options,
+                        bool &invalid);
+
+// A program in executable memory, entry is nullptr if it could not be mapped.
+// Whoever is done with it gives the memory back with unmapExecutable.
+struct CompiledProgram {
+  JitFunction entry;
+  size_t mappedBytes;
+};
+
+// Compiles and assembles the source with the backend the options choose.
+// Big sources are compiled in chunks on up to as many threads.
+// Counting emits the I/O counters, guards come from the analysis, if any.
+// Fills in the compile and assemble times and the code size of the report.
+CompiledProgram compileProgram(const std::string &source,
+                               const Analysis* analysis,
+                               const BackendOptions &options, bool counting,
+                               unsigned threads, Stats &report);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef cells_hpp
+#define cells_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A cell that a straight-line run of code changes.
+// The offset is relative to the pointer at the start of the run.
+struct CellUpdate {
+  int64_t offset;
+  // Whether the cell is set to the value, as after [-], or the value is added.
+  bool set;
+  uint8_t value;
+};
+
+// How many adjacent cells, in offset order, starting at first are cleared.
+inline size_t zeroRun(const std::vector<CellUpdate> &cells, size_t first) {
+  size_t end = first;
+  while (end < cells.size() && cells[end].set && cells[end].value == 0
+         && cells[end].offset - cells[first].offset
+            == static_cast<int64_t>(end - first)) {
+    end++;
+  }
+  return end - first;
+}
+
+#endif
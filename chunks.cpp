@@ -0,0 +1,139 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <thread>
+#include "chunks.hpp"
+
+// What the brackets of a chunk do on their own.
+struct Scan {
+  // How many [ there are.
+  uint64_t loops;
+  // How many ] close a loop opened before the chunk.
+  uint64_t closes;
+  // The [ still open at the end, numbered from the first in the chunk.
+  std::vector<uint64_t> open;
+};
+
+// Whether the compiler reads the character at all.
+static bool isCommand(char c) {
+  switch (c) {
+    case '+':
+    case '-':
+    case '>':
+    case '<':
+    case '[':
+    case ']':
+    case '.':
+    case ',':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether a chunk can start at the character, which it can at a [ unless the
+// compiler turns it into a store as part of [-].
+static bool opensLoop(const std::string &source, size_t at) {
+  if (source[at] != '[') {
+    return false;
+  }
+  char next[2] = {0, 0};
+  size_t found = 0;
+  for (size_t i = at + 1; i < source.size() && found < 2; i++) {
+    if (isCommand(source[i])) {
+      next[found++] = source[i];
+    }
+  }
+  return next[0] != '-' || next[1] != ']';
+}
+
+// Matches the brackets of a single chunk.
+static Scan scan(const std::string &source, size_t begin, size_t end) {
+  Scan result = {0u, 0u, {}};
+  for (size_t i = begin; i < end; i++) {
+    if (source[i] == '[') {
+      result.open.push_back(result.loops++);
+    } else if (source[i] == ']') {
+      if (result.open.empty()) {
+        result.closes++;
+      } else {
+        result.open.pop_back();
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<Chunk> splitChunks(const std::string &source, unsigned count,
+                               size_t minimum) {
+  std::vector<Chunk> single = {{0u, source.size(), 0u, {}}};
+  count = std::min<size_t>(count, source.size() / std::max<size_t>(minimum, 1));
+  if (count <= 1) {
+    return single;
+  }
+
+  // Aim for chunks of the same size, starting each at the next loop.
+  std::vector<size_t> cuts = {0u};
+  for (unsigned i = 1; i < count; i++) {
+    size_t at = std::max(source.size() / count * i, cuts.back() + 1);
+    while (at < source.size() && !opensLoop(source, at)) {
+      at++;
+    }
+    if (at >= source.size()) {
+      break;
+    }
+    cuts.push_back(at);
+  }
+  cuts.push_back(source.size());
+  size_t chunks = cuts.size() - 1;
+  if (chunks <= 1) {
+    return single;
+  }
+
+  std::vector<Scan> scans(chunks);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < chunks; i++) {
+    threads.emplace_back([&, i]() {
+      scans[i] = scan(source, cuts[i], cuts[i + 1]);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Every chunk closes the innermost loops left open by the ones before it.
+  std::vector<Chunk> result;
+  std::vector<uint64_t> open;
+  uint64_t loops = 0;
+  for (size_t i = 0; i < chunks; i++) {
+    if (scans[i].closes > open.size()) {
+      return single;
+    }
+    result.push_back({cuts[i], cuts[i + 1], loops, open});
+    open.resize(open.size() - scans[i].closes);
+    for (uint64_t loop : scans[i].open) {
+      open.push_back(loops + loop);
+    }
+    loops += scans[i].loops;
+  }
+  if (!open.empty()) {
+    return single;
+  }
+  return result;
+}
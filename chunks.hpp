@@ -0,0 +1,47 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef chunks_hpp
+#define chunks_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "constants.hpp"
+
+// A part of the source that compiles on its own thread.
+// Every chunk but the first starts with a [ that opens an actual loop, where
+// the compiler flushes everything anyway.
+struct Chunk {
+  size_t begin;
+  size_t end;
+  // How many [ come before the chunk, the loops in it are numbered from here.
+  uint64_t loops;
+  // The loops still open where the chunk starts, outermost first.
+  std::vector<uint64_t> open;
+};
+
+// Splits the source into at most count chunks of at least minimum bytes.
+// Each chunk is scanned for brackets on its own thread, after which a prefix
+// sum over the scans finds the loops open at every chunk start.
+// Unbalanced sources are left a single chunk, as is everything too small.
+std::vector<Chunk> splitChunks(const std::string &source, unsigned count,
+                               size_t minimum = CHUNK_BYTES);
+
+#endif
@@ -18,92 +18,148 @@
 
 #include "compiler.hpp"
 #include "constants.hpp"
+#include "copypatch.hpp"
+#include "transpiler.hpp"
 #include <algorithm>
 #include <iostream>
 
 // Macro magic to make life easier.
-#define __ _assembler-> 
-#define REPEATER(fn, arg)                                                \
-uint64_t iters = abs / ADD_SUB_IMM_LIMIT, rem = abs % ADD_SUB_IMM_LIMIT; \
-for (uint64_t i = 0; i < iters; i++) {                                   \
-  fn(memPtr, memPtr, ADD_SUB_IMM_LIMIT);                                 \
-}                                                                        \
-fn(memPtr, memPtr, rem);
+#define __ _backend->
 #define SKIP(n) _skip = n + 1
 
 // Also have a custom null char.
 constexpr char NIL = 0;
 
 // Create a blank compiler.
-Compiler::Compiler(Assembler* assembler) 
-  : _assembler(assembler), _cellDelta(0u), _pointerDelta(0u),
-    _mem1(NIL), _mem2(NIL), _skip(0) {}
+template <class Backend>
+Compiler<Backend>::Compiler(Backend* backend, const Analysis* analysis)
+  : Compiler(backend, analysis, Chunk{0u, 0u, 0u, {}}) {}
+
+// Create a compiler for a chunk, which only guards the start of the program.
+template <class Backend>
+Compiler<Backend>::Compiler(Backend* backend, const Analysis* analysis,
+                            const Chunk &chunk)
+  : _backend(backend), _analysis(analysis), _pointerDelta(0u),
+    _mem1(NIL), _mem2(NIL), _position(chunk.begin), _pos1(0u), _pos2(0u),
+    _skip(0), _firstLoop(chunk.loops), _commands(0u), _loops(0u),
+    _clearLoops(0u), _guards(0u) {
+  if (chunk.begin == 0 && _analysis != nullptr
+      && _analysis->start() != nullptr) {
+    __ guard(*_analysis->start());
+    _guards++;
+  }
+  // The backend knows the open loops by their depth.
+  for (size_t depth = 0; depth < chunk.open.size(); depth++) {
+    _jumps.push({depth, chunk.open[depth], 0u, false, true, 0, true});
+  }
+}
 
 // Performs the actual compilation.
-void Compiler::_compile(char &c, char &fut1, char &fut2) {
+template <class Backend>
+void Compiler<Backend>::_compile(char &c, char &fut1, char &fut2) {
+  // Each command costs the loop it is directly in.
+  if (!_jumps.empty()) {
+    _jumps.top().cost++;
+  }
   switch (c) {
+    // Straight-line code only changes cells, which are applied all at once
+    // when the pointer has to be where it claims.
     case '+':
-      flushPointer();
-      _cellDelta++;
+      _cells[_pointerDelta].value++;
       break;
     case '-':
-      flushPointer();
-      _cellDelta--;
+      _cells[_pointerDelta].value--;
       break;
     case '>':
-      flushCell();
       _pointerDelta++;
       break;
     case '<':
-      flushCell();
       _pointerDelta--;
       break;
     case '[':
-      flushCell();
-      flushPointer();
       // Try to optimize [-].
+      // Its only access is the cell the enclosing guard already covers.
       if (__builtin_expect(fut1 == '-' && fut2 == ']', false)) {
-        // Move zero to the address at the current memory address.
-        __ mov(tmp1);
-        __ strb(tmp1, memBase, memPtr);
+        _cells[_pointerDelta] = {_pointerDelta, true, 0u};
+        _clearLoops++;
+        if (!_jumps.empty()) {
+          _jumps.top().cost += 2;
+        }
         SKIP(2);
       } else {
-        __ ldrb(tmp1, memBase, memPtr);
-        _jumps.push(__ cbz(tmp1));
+        // The enclosing loop is no longer straight-line code.
+        if (!_jumps.empty()) {
+          _jumps.top().straight = false;
+        }
+        flushCell();
+        flushPointer();
+        size_t loop = _firstLoop + _loops + _clearLoops;
+        const Guard* body = _analysis ? _analysis->body(loop) : nullptr;
+        // Balanced loops only need the guard when entering.
+        bool once = body != nullptr && _analysis->balanced(loop);
+        _jumps.push({__ loopStart(once ? body : nullptr), loop, 0u, true, true,
+                     0, false});
+        if (body != nullptr) {
+          if (!once) {
+            __ guard(*body);
+          }
+          _guards++;
+        }
+        _loops++;
       }
       break;
     case ']': {
+      // Loops that cannot run away are charged to the enclosing loop instead,
+      // these are most loops and their iterations are short.
+      // Outer loops are charged what this chunk knows, patched later.
+      bool bounded = !_jumps.top().outer && _bounded();
       flushCell();
       flushPointer();
-      __ ldrb(tmp1, memBase, memPtr);
-      // The start and end points are in the program counter.
-      size_t start = _jumps.top();
+      if (!bounded) {
+        __ chargeFuel(_jumps.top().cost, _pos1);
+      }
+      __ loopEnd(_jumps.top().handle);
+      // Past a loop that moves the pointer, it has to be checked again.
+      const Guard* exit = _analysis ? _analysis->exit(_jumps.top().loop)
+                                    : nullptr;
+      if (exit != nullptr) {
+        __ guard(*exit);
+        _guards++;
+      }
+      Jump closed = _jumps.top();
       _jumps.pop();
-      size_t end = __ cbnz(tmp1);
-      // However, we need the offsets in actual memory address.
-      // This is a bit useless because we will divide by 4 anyway, but it helps
-      // in the intermeditate processing.
-      // Forward: we jump to the instruction after.
-      int32_t deltaF = static_cast<int32_t>(end)
-                       - static_cast<int32_t>(start)
-                       + 1;
-      __ patchBranch(start, deltaF);
-      // Backward: we jump to the instruction after too.
-      int32_t deltaB = static_cast<int32_t>(start)
-                       - static_cast<int32_t>(end)
-                       + 1;
-      __ patchBranch(end, deltaB);
+      if (closed.outer) {
+        // Its enclosing loop is an outer one as well.
+        _spans.push_back({closed.handle, closed.cost, closed.known,
+                          closed.stride, true, _pos1});
+      } else if (!_jumps.empty()) {
+        if (bounded) {
+          _jumps.top().cost += closed.cost;
+        }
+        // Only loops that end where they started keep the stride known.
+        if (!bounded || !closed.known || closed.stride != 0) {
+          _jumps.top().known = false;
+        }
+      }
       break;
     }
     case '.':
+      if (!_jumps.empty()) {
+        _jumps.top().straight = false;
+      }
       flushCell();
       flushPointer();
-      __ syscallOut();
+      __ output();
+      _guardIo();
       break;
     case ',':
+      if (!_jumps.empty()) {
+        _jumps.top().straight = false;
+      }
       flushCell();
       flushPointer();
-      __ syscallIn();
+      __ input();
+      _guardIo();
       break;
     default:
       assert(false); // should never get an illegal instruction.
@@ -111,8 +167,44 @@ void Compiler::_compile(char &c, char &fut1, char &fut2) {
 
 }
 
+// What comes after I/O is only checked once the I/O is done.
+template <class Backend>
+void Compiler<Backend>::_guardIo() {
+  const Guard* after = _analysis ? _analysis->io(_pos1) : nullptr;
+  if (after != nullptr) {
+    __ guard(*after);
+    _guards++;
+  }
+}
+
+// Either the body moves the pointer by a known amount, such that the loop
+// leaves the memory at some point and a guard stops it, or the body is
+// straight-line code that
+// ends where it started and steps the tested cell by an odd amount, or
+// clears it, such that the loop ends within 256 iterations.
+template <class Backend>
+bool Compiler<Backend>::_bounded() const {
+  const Jump &jump = _jumps.top();
+  int64_t stride = jump.stride + _pointerDelta;
+  // Without guards, leaving the memory is no end at all.
+  if (jump.known && stride != 0 && _analysis != nullptr) {
+    return true;
+  }
+  if (!jump.straight || stride != 0) {
+    return false;
+  }
+  // The body started right after a flush, so offsets are from the test.
+  auto tested = _cells.find(0);
+  if (tested == _cells.end()) {
+    return false;
+  }
+  const CellUpdate &cell = tested->second;
+  return cell.set ? cell.value == 0 : cell.value % 2 == 1;
+}
+
 // Compile an individual character.
-void Compiler::compile(char &current) {
+template <class Backend>
+void Compiler<Backend>::compile(char &current) {
   // Ensure to only compile valid instructions.
   // This makes sure that e.g. whitespace is not in the buffer.
   switch (current) {
@@ -124,55 +216,86 @@ void Compiler::compile(char &current) {
     case ']':
     case '.':
     case ',':
+      _commands++;
+      [[fallthrough]];
     // Allow null which happens at the end of the buffer.
     case NIL:
       _skip = std::max(_skip - 1, 0);
       if (_mem1 != NIL && _skip == 0) {
-        Compiler::_compile(_mem1, _mem2, current);
+        _compile(_mem1, _mem2, current);
       }
       // Shift everything left by one: mem2 -> mem1, current -> mem2
       _mem1 = _mem2;
       _mem2 = current;
+      _pos1 = _pos2;
+      _pos2 = _position;
       break;
   }
+  _position++;
 }
 
 // Flush with phantom characters such that the buffer is emptied.
-void Compiler::flushCompilationBuffer() {
+template <class Backend>
+void Compiler<Backend>::flushCompilationBuffer() {
   char nil = NIL;
   // Our buffer is of size two so we feed two nil characters.
-  Compiler::compile(nil);
-  Compiler::compile(nil);
+  compile(nil);
+  compile(nil);
 }
 
-void Compiler::flushCell() {
+template <class Backend>
+void Compiler<Backend>::flushCell() {
+  std::vector<CellUpdate> cells;
+  for (auto &entry : _cells) {
+    // Adding zero is no change, but setting zero is.
+    if (entry.second.set || entry.second.value != 0) {
+      entry.second.offset = entry.first;
+      cells.push_back(entry.second);
+    }
+  }
+  _cells.clear();
   // Only flush if there is something to flush.
-  if (_cellDelta == 0) {
+  if (cells.empty()) {
     return;
   }
-  // Write the address to tmp1 and the value to write to tmp2.
-  __ add(tmp1, memBase, memPtr);
-  // This will treat the signed offset as an unsigned value, but that is fine
-  // given that the mov instruction with immediate supports signed values.
-  __ mov(tmp2, _cellDelta);
-  __ ldaddb(tmp1, tmp2);
-  _cellDelta = 0;
+  __ updateCells(cells);
 }
 
-void Compiler::flushPointer() {
+template <class Backend>
+void Compiler<Backend>::flushPointer() {
   // Only flush if there is something to flush.
   if (_pointerDelta == 0) {
     return;
   }
-  uint64_t abs = std::abs(_pointerDelta);
-  if (_pointerDelta > 0) {
-    REPEATER(__ add, abs);
-  } else {
-    REPEATER(__ sub, abs);
+  if (!_jumps.empty()) {
+    _jumps.top().stride += _pointerDelta;
   }
+  __ movePointer(_pointerDelta);
   _pointerDelta = 0;
 }
 
+template <class Backend>
+void Compiler<Backend>::flushChunk() {
+  // The [ starting the next chunk ends straight-line code.
+  if (!_jumps.empty()) {
+    _jumps.top().straight = false;
+  }
+  flushCell();
+  flushPointer();
+  std::vector<Jump> open;
+  for (; !_jumps.empty(); _jumps.pop()) {
+    open.push_back(_jumps.top());
+  }
+  for (auto jump = open.rbegin(); jump != open.rend(); jump++) {
+    _spans.push_back({jump->handle, jump->cost, jump->known, jump->stride,
+                      false, 0u});
+  }
+}
+
+// The backends this compiler drives.
+template class Compiler<Assembler>;
+template class Compiler<CopyPatch>;
+template class Compiler<Transpiler>;
+
 #undef SKIP
-#undef REPEATER
 #undef __
@@ -19,22 +19,91 @@
 #ifndef compiler_hpp
 #define compiler_hpp
 
+#include "analysis.hpp"
 #include "assembler.hpp"
+#include "cells.hpp"
+#include "chunks.hpp"
+#include "stats.hpp"
+#include <map>
+#include <memory>
 #include <stack>
+#include <string>
+#include <thread>
+#include <vector>
 
+// Folds Brainfuck into runs and idioms and hands them to a backend.
+// A backend provides updateCells, movePointer, loopStart, loopEnd, output and
+// input; see Assembler for the JIT and Transpiler for C.
+// Given an analysis, it also asks the backend for guard and guarded loops.
+// Before every ], the backend may charge fuel for the loop body.
+// To compile chunks in parallel, a backend also provides fragment, append
+// and patchFuel; see translateChunks.
+template <class Backend>
 class Compiler {
+public:
+  // What a chunk adds to a loop that spans chunks: the cost, and whether and
+  // how far it moves the pointer. A loop closed in the chunk was charged fuel
+  // before the ] at position, with only the cost this chunk knows about.
+  struct Span {
+    size_t handle;
+    uint64_t cost;
+    bool known;
+    int64_t stride;
+    bool closed;
+    uint64_t position;
+  };
+
 private:
-  Assembler* _assembler;
-  std::stack<size_t> _jumps;
-  int8_t _cellDelta;
+  Backend* _backend;
+  const Analysis* _analysis;
+  // An open loop: the backend's handle, which loop it is, and how many
+  // commands its body has outside of nested loops so far.
+  // Whether the body is straight-line code so far, and how far it moved the
+  // pointer, if that is known, decide whether the loop can run away.
+  // Outer loops were opened by an earlier chunk, only the chunks together
+  // know that.
+  struct Jump {
+    size_t handle;
+    size_t loop;
+    uint64_t cost;
+    bool straight;
+    bool known;
+    int64_t stride;
+    bool outer;
+  };
+  std::stack<Jump> _jumps;
+  std::vector<Span> _spans;
+  // The cells changed since the pointer was last flushed, by offset.
+  std::map<int64_t, CellUpdate> _cells;
   int64_t _pointerDelta;
   char _mem1;
   char _mem2;
+  // Where in the source the next character is, and the buffered ones were.
+  uint64_t _position;
+  uint64_t _pos1;
+  uint64_t _pos2;
   int8_t _skip;
+  // How many loops come before the chunk.
+  uint64_t _firstLoop;
+  uint64_t _commands;
+  uint64_t _loops;
+  uint64_t _clearLoops;
+  uint64_t _guards;
   void _compile(char &c, char &fut1, char &fut2);
 
+  // Whether the loop about to close surely ends, or leaves the memory, within
+  // a bounded number of iterations.
+  bool _bounded() const;
+
+  // Guards what follows the . or , just compiled, if it needs to.
+  void _guardIo();
+
 public:
-  Compiler(Assembler* assembler);
+  // With an analysis, the start of the program is guarded right away.
+  Compiler(Backend* backend, const Analysis* analysis = nullptr);
+
+  // Compiles a chunk of the source, starting inside its open loops.
+  Compiler(Backend* backend, const Analysis* analysis, const Chunk &chunk);
 
   // Performs a compilation of a single instruction.
   void compile(char &c);
@@ -42,11 +111,159 @@ public:
   // Flushes the compilation buffer of instructions.
   void flushCompilationBuffer();
 
-  // Flushes the cell value difference into an instruction.
+  // Flushes the changed cells into instructions.
   void flushCell();
 
   // Flushes the memory pointer difference into (an) instruction(s).
   void flushPointer();
 
+  // Ends a chunk that the next one continues with a [, flushing what that [
+  // would, and records what the chunk added to the loops still open.
+  void flushChunk();
+
+  // What the chunk added to loops that span chunks. Closed ones come first,
+  // then the open ones, outermost first.
+  inline const std::vector<Span> &spans() const { return _spans; }
+
+  // How many Brainfuck commands were compiled.
+  inline uint64_t commands() const { return _commands; }
+
+  // How many loops were compiled as an actual loop.
+  inline uint64_t loops() const { return _loops; }
+
+  // How many loops were recognized as [-] and compiled to a store.
+  inline uint64_t clearLoops() const { return _clearLoops; }
+
+  // How many bounds checks were emitted.
+  inline uint64_t guards() const { return _guards; }
+
 };
+
+// Feeds the whole source through the compiler into a backend.
+// With an analysis, accesses are guarded.
+template <class Backend>
+inline void translate(Backend &backend, const std::string &source,
+                      const Analysis* analysis, Stats &report) {
+  // Write the prelude with the backend.
+  backend.prelude();
+
+  // Compile it via the compiler.
+  Compiler<Backend> compiler(&backend, analysis);
+  for (char ch : source) {
+    compiler.compile(ch);
+  }
+  compiler.flushCompilationBuffer();
+
+  // Write the postlude with the backend.
+  backend.postlude();
+  report.commands = compiler.commands();
+  report.loops = compiler.loops();
+  report.clearLoops = compiler.clearLoops();
+  report.guards = compiler.guards();
+  report.chunks = 1;
+}
+
+// Feeds every chunk through its own compiler, on its own thread, into a
+// fragment of the backend, which are then appended in order.
+// Loops that span chunks are closed in a later fragment than they are opened
+// in, their branches are patched when appending. Whether they can run away
+// is only known from all chunks, so their fuel charge is patched here.
+template <class Backend>
+inline void translateChunks(Backend &backend, const std::string &source,
+                            const Analysis* analysis, Stats &report,
+                            const std::vector<Chunk> &chunks) {
+  if (chunks.size() <= 1) {
+    translate(backend, source, analysis, report);
+    return;
+  }
+  std::vector<Backend> fragments;
+  std::vector<std::unique_ptr<Compiler<Backend>>> compilers;
+  fragments.reserve(chunks.size());
+  for (const Chunk &chunk : chunks) {
+    fragments.push_back(backend.fragment(chunk.end - chunk.begin,
+                                         chunk.open.size()));
+    compilers.push_back(std::make_unique<Compiler<Backend>>(
+      &fragments.back(), analysis, chunk));
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    threads.emplace_back([&, i]() {
+      Compiler<Backend> &compiler = *compilers[i];
+      for (size_t at = chunks[i].begin; at < chunks[i].end; at++) {
+        char ch = source[at];
+        compiler.compile(ch);
+      }
+      compiler.flushCompilationBuffer();
+      if (i + 1 < chunks.size()) {
+        compiler.flushChunk();
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // A loop that spans chunks, as far as the chunks so far know.
+  struct Open {
+    size_t handle;
+    uint64_t cost;
+    bool known;
+    int64_t stride;
+  };
+  std::vector<Open> open;
+  // The handles of the outer loops of every fragment, where loops are
+  // numbered through all fragments.
+  std::vector<std::vector<size_t>> outer(chunks.size());
+  backend.prelude();
+  size_t handles = backend.loops();
+  report.commands = report.loops = report.clearLoops = report.guards = 0u;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    for (const Open &loop : open) {
+      outer[i].push_back(loop.handle);
+    }
+    // The chunk closes the innermost loops, and adds to the others.
+    size_t kept = open.size();
+    for (const auto &span : compilers[i]->spans()) {
+      if (span.handle >= outer[i].size()) {
+        continue;
+      }
+      Open &loop = open[span.handle];
+      loop.cost += span.cost;
+      loop.known = loop.known && span.known;
+      loop.stride += span.stride;
+      if (!span.closed) {
+        continue;
+      }
+      // The same rules as for a loop in a single chunk, see Compiler.
+      bool bounded = analysis != nullptr && loop.known && loop.stride != 0;
+      fragments[i].patchFuel(span.position, bounded ? 0u : loop.cost);
+      if (span.handle > 0) {
+        Open &parent = open[span.handle - 1];
+        if (bounded) {
+          parent.cost += loop.cost;
+        }
+        // Bounded here means it has a stride, the parent loses it either way.
+        parent.known = false;
+      }
+      kept = span.handle;
+    }
+    open.resize(kept);
+    // Loops opened in the chunk and left open continue in the next one.
+    for (const auto &span : compilers[i]->spans()) {
+      if (span.handle >= outer[i].size()) {
+        open.push_back({handles + span.handle - outer[i].size(), span.cost,
+                        span.known, span.stride});
+      }
+    }
+    handles += fragments[i].loops() - outer[i].size();
+    report.commands += compilers[i]->commands();
+    report.loops += compilers[i]->loops();
+    report.clearLoops += compilers[i]->clearLoops();
+    report.guards += compilers[i]->guards();
+  }
+  backend.append(fragments, outer);
+  backend.postlude();
+  report.chunks = chunks.size();
+}
+
 #endif
@@ -26,6 +26,24 @@
 // Wrap-around is forbidden, so it's good to have a large space.
 constexpr size_t MEMORY_SIZE = 50000;
 
+// What the JIT returns when a guard finds an access out of bounds.
+constexpr uint16_t EXIT_OUT_OF_BOUNDS = 2;
+
+// What the JIT returns when it runs out of fuel, it can be entered again.
+constexpr uint16_t EXIT_OUT_OF_FUEL = 3;
+
+// How many cells fit a vector register.
+// Vector updates load and store all of them, even past the last cell changed,
+// so the JIT memory is padded by as much.
+constexpr size_t VECTOR_CELLS = 16;
+
+// Cleared runs at least this long become a store loop instead of unrolled.
+constexpr size_t CLEAR_LOOP_CELLS = 64;
+
+// Sources are only split for parallel compilation into chunks this big,
+// anything smaller compiles faster than a thread starts.
+constexpr size_t CHUNK_BYTES = 1 << 18;
+
 // How many times we can add/sub.
 constexpr uint16_t ADD_SUB_IMM_LIMIT = (1 << 12) - 1;
 
@@ -0,0 +1,60 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef context_hpp
+#define context_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+// State shared between the host and the JIT subroutine.
+// The address is passed in x1. Counting continues from what is already there.
+struct Context {
+  uint64_t bytesWritten;
+  uint64_t bytesRead;
+  // A preemption budget rather than a command count: each iteration of a loop
+  // that may not end costs the commands in its body, loops known to end are
+  // only charged once to the loop around them.
+  int64_t fuel;
+  // Where the fuel ran out: the position of the ] in the source, and the
+  // pointer as an offset into the memory.
+  uint64_t position;
+  uint64_t pointer;
+  // Where to continue when entered again, or zero to start from the top.
+  uint64_t resume;
+  // Where output goes and input comes from, a server points these elsewhere.
+  int64_t outFd = 1;
+  int64_t inFd = 0;
+};
+
+// How the host enters JIT code, for all backends.
+// The pointer is where the memory pointer starts, which is only not the
+// beginning of the memory when resuming.
+typedef int (*JitFunction)(uint8_t* memory, Context* context, uint8_t* pointer);
+
+// The JIT stores with scaled 64-bit offsets, so keep everything 8 aligned.
+constexpr uint16_t CONTEXT_BYTES_WRITTEN = offsetof(Context, bytesWritten);
+constexpr uint16_t CONTEXT_BYTES_READ = offsetof(Context, bytesRead);
+constexpr uint16_t CONTEXT_FUEL = offsetof(Context, fuel);
+constexpr uint16_t CONTEXT_POSITION = offsetof(Context, position);
+constexpr uint16_t CONTEXT_POINTER = offsetof(Context, pointer);
+constexpr uint16_t CONTEXT_RESUME = offsetof(Context, resume);
+constexpr uint16_t CONTEXT_OUT_FD = offsetof(Context, outFd);
+constexpr uint16_t CONTEXT_IN_FD = offsetof(Context, inFd);
+
+#endif
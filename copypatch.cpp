@@ -0,0 +1,487 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include "constants.hpp"
+#include "copypatch.hpp"
+#include "executable.hpp"
+#include "stencils.h"
+
+// Both slots and trampolines are 16 bytes at most, keep them aligned.
+constexpr size_t TRAMPOLINE_SIZE = 16;
+constexpr size_t SLOT_SIZE = 8;
+// tbz and tbnz reach 32K, so islands come often enough that the short holes
+// since the last one and the island itself stay within half of that.
+constexpr size_t ISLAND_SPACING = 1 << 13;
+
+// Whether a hole is a conditional branch, which may not reach a far target.
+static bool isShort(HoleKind kind) {
+  return kind == HoleKind::Branch19 || kind == HoleKind::Branch14;
+}
+
+// Whether a branch hole reaches that far, other holes always do.
+static bool reaches(HoleKind kind, int64_t relative) {
+  int bits = 64;
+  switch (kind) {
+    case HoleKind::Branch26:
+      bits = 28;
+      break;
+    case HoleKind::Branch19:
+      bits = 21;
+      break;
+    case HoleKind::Branch14:
+      bits = 16;
+      break;
+    default:
+      break;
+  }
+  return bits == 64 || (relative >= -(1ll << (bits - 1))
+                        && relative < (1ll << (bits - 1)));
+}
+
+CopyPatch::CopyPatch(uintmax_t heuristic, bool counting, bool fueled)
+  : _outer(0u), _counting(counting), _fueled(fueled), _stencils(0u),
+    _mappedBytes(0u), _offset(0) {
+  // A stencil is a couple of instructions per Brainfuck instruction.
+  _code.reserve(heuristic * 8);
+}
+
+CopyPatch CopyPatch::fragment(uintmax_t heuristic, size_t outer) const {
+  CopyPatch fragment(heuristic, _counting, _fueled);
+  fragment._outer = outer;
+  fragment._loops.resize(outer);
+  return fragment;
+}
+
+void CopyPatch::append(std::vector<CopyPatch> &fragments,
+                       const std::vector<std::vector<size_t>> &outer) {
+  // The targets of short branches still waiting are at least a fragment away.
+  island();
+  std::vector<std::thread> islands;
+  for (CopyPatch &fragment : fragments) {
+    islands.emplace_back([&fragment]() {
+      fragment.flushOffset();
+      fragment.island();
+    });
+  }
+  for (std::thread &thread : islands) {
+    thread.join();
+  }
+
+  // Where everything of each fragment goes, and thus how far it moves.
+  struct Base {
+    size_t code;
+    size_t patches;
+    size_t loops;
+    size_t charges;
+  };
+  std::vector<Base> bases;
+  Base end = {_code.size(), _patches.size(), _loops.size(), _charges.size()};
+  for (const CopyPatch &fragment : fragments) {
+    bases.push_back(end);
+    end.code += fragment._code.size();
+    end.patches += fragment._patches.size();
+    end.loops += fragment._loops.size() - fragment._outer;
+    end.charges += fragment._charges.size();
+    _stencils += fragment._stencils;
+  }
+  _code.resize(end.code);
+  _patches.resize(end.patches);
+  _loops.resize(end.loops);
+  _charges.resize(end.charges);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < fragments.size(); i++) {
+    threads.emplace_back([&, i]() {
+      const CopyPatch &fragment = fragments[i];
+      const Base &base = bases[i];
+      std::copy(fragment._code.begin(), fragment._code.end(),
+                _code.begin() + base.code);
+      for (size_t at = 0; at < fragment._patches.size(); at++) {
+        Patch patch = fragment._patches[at];
+        patch.at += base.code;
+        if (patch.hole.value == HoleValue::Continue
+            || patch.hole.value == HoleValue::Target) {
+          patch.value += base.code;
+        }
+        if (patch.veneer != 0) {
+          patch.veneer += base.patches;
+        }
+        _patches[base.patches + at] = patch;
+      }
+      for (size_t loop = fragment._outer; loop < fragment._loops.size();
+           loop++) {
+        _loops[base.loops + loop - fragment._outer] = {
+          fragment._loops[loop].firstPatch + base.patches,
+          fragment._loops[loop].body + base.code};
+      }
+      for (size_t at = 0; at < fragment._charges.size(); at++) {
+        _charges[base.charges + at] = {
+          fragment._charges[at].first,
+          fragment._charges[at].second + base.patches};
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Loops that span fragments are closed once all of them are in.
+  for (size_t i = 0; i < fragments.size(); i++) {
+    assert(outer[i].size() == fragments[i]._outer);
+    for (const OuterEnd &end : fragments[i]._outerEnds) {
+      const Loop &loop = _loops[outer[i][end.loop]];
+      target(loop.firstPatch, STENCIL_LOOP_START, end.after + bases[i].code);
+      target(end.firstPatch + bases[i].patches, STENCIL_LOOP_END, loop.body);
+    }
+  }
+}
+
+void CopyPatch::patchFuel(uint64_t position, uint64_t cost) {
+  for (auto charge = _charges.rbegin(); charge != _charges.rend(); charge++) {
+    if (charge->first != position) {
+      continue;
+    }
+    for (size_t i = charge->second;
+         i < charge->second + STENCIL_FUEL.holeCount; i++) {
+      if (_patches[i].hole.value == HoleValue::Delta) {
+        _patches[i].value = cost;
+      }
+    }
+    return;
+  }
+}
+
+size_t CopyPatch::emit(const Stencil &stencil, uint64_t delta,
+                       uint64_t limit) {
+  keepInReach(stencil.size);
+  size_t start = _code.size();
+  size_t firstPatch = _patches.size();
+  _code.insert(_code.end(), stencil.code, stencil.code + stencil.size);
+  for (uint32_t i = 0; i < stencil.holeCount; i++) {
+    const Hole &hole = stencil.holes[i];
+    uint64_t value = 0;
+    switch (hole.value) {
+      case HoleValue::Continue:
+        value = start + stencil.size;
+        break;
+      case HoleValue::Target:
+        // Patched once the other side of the loop is known.
+        break;
+      case HoleValue::Delta:
+        value = delta;
+        break;
+      case HoleValue::Limit:
+      case HoleValue::Position:
+        value = limit;
+        break;
+      case HoleValue::Write:
+        value = reinterpret_cast<uint64_t>(&write);
+        break;
+      case HoleValue::Read:
+        value = reinterpret_cast<uint64_t>(&read);
+        break;
+    }
+    if (hole.value == HoleValue::Target && isShort(hole.kind)) {
+      _shortTargets.push_back(_patches.size());
+    }
+    _patches.push_back({start + hole.offset, hole, value, 0});
+  }
+  _stencils++;
+  return firstPatch;
+}
+
+void CopyPatch::target(size_t firstPatch, const Stencil &stencil,
+                       size_t offset) {
+  for (size_t i = firstPatch; i < firstPatch + stencil.holeCount; i++) {
+    // A short branch through an island has its b point there instead.
+    Patch &patch = _patches[_patches[i].veneer != 0 ? _patches[i].veneer : i];
+    if (patch.hole.value == HoleValue::Target) {
+      patch.value = offset;
+    }
+  }
+}
+
+size_t CopyPatch::branch(HoleValue value, uint64_t offset) {
+  // b #0
+  const uint8_t b[] = {0x00, 0x00, 0x00, 0x14};
+  size_t at = _code.size();
+  _code.insert(_code.end(), b, b + sizeof(b));
+  _patches.push_back({at, {0, HoleKind::Branch26, value, false, 0}, offset, 0});
+  return _patches.size() - 1;
+}
+
+void CopyPatch::keepInReach(size_t size) {
+  if (__builtin_expect(!_shortTargets.empty(), false)
+      && _code.size() + size - _patches[_shortTargets.front()].at
+         >= ISLAND_SPACING) {
+    island();
+  }
+}
+
+void CopyPatch::island() {
+  // Loops are never closed at the very start, so a zero target is not known
+  // yet. Known targets may be in reach, as offsets within a fragment stay.
+  std::vector<size_t> far;
+  for (size_t at : _shortTargets) {
+    const Patch &patch = _patches[at];
+    int64_t relative = static_cast<int64_t>(patch.value - patch.at)
+                       + patch.hole.addend;
+    if (patch.value == 0 || !reaches(patch.hole.kind, relative)) {
+      far.push_back(at);
+    }
+  }
+  _shortTargets.clear();
+  if (far.empty()) {
+    return;
+  }
+  size_t over = branch(HoleValue::Continue, 0);
+  for (size_t at : far) {
+    size_t veneer = branch(HoleValue::Target, _patches[at].value);
+    // The hole now goes to the b, which goes on to the target.
+    _patches[at].hole.value = HoleValue::Continue;
+    _patches[at].value = _patches[veneer].at;
+    _patches[at].veneer = veneer;
+  }
+  _patches[over].value = _code.size();
+}
+
+void CopyPatch::prelude() {
+  // The host sets up the pointer, there is only resuming to take care of.
+  if (_fueled) {
+    emit(STENCIL_ENTER);
+  }
+}
+
+void CopyPatch::postlude() {
+  // Backward branches at the end may not reach either.
+  island();
+  emit(STENCIL_EXIT);
+}
+
+void CopyPatch::flushOffset() {
+  if (_offset == 0) {
+    return;
+  }
+  emit(STENCIL_MOVE_POINTER, static_cast<uint64_t>(_offset));
+  _offset = 0;
+}
+
+void CopyPatch::updateCells(const std::vector<CellUpdate> &cells) {
+  // The stencils only change the cell under the pointer, so walk it along.
+  for (const CellUpdate &cell : cells) {
+    _offset += cell.offset;
+    flushOffset();
+    if (cell.set) {
+      emit(STENCIL_CLEAR_CELL);
+    }
+    if (cell.value != 0) {
+      emit(STENCIL_ADD_CELL, cell.value);
+    }
+    _offset -= cell.offset;
+  }
+}
+
+void CopyPatch::movePointer(int64_t delta) {
+  _offset += delta;
+}
+
+void CopyPatch::guard(const Guard &range) {
+  emit(STENCIL_GUARD, static_cast<uint64_t>(_offset + range.low),
+       guardLimit(range));
+}
+
+size_t CopyPatch::loopStart(const Guard* once) {
+  // The condition is checked at the same pointer each iteration.
+  flushOffset();
+  size_t firstPatch = emit(STENCIL_LOOP_START);
+  if (once != nullptr) {
+    guard(*once);
+  }
+  _loops.push_back({firstPatch, _code.size()});
+  return _loops.size() - 1;
+}
+
+void CopyPatch::chargeFuel(uint64_t cost, uint64_t position) {
+  if (!_fueled) {
+    return;
+  }
+  flushOffset();
+  _charges.emplace_back(position, emit(STENCIL_FUEL, cost, position));
+}
+
+void CopyPatch::loopEnd(size_t start) {
+  flushOffset();
+  size_t firstPatch = emit(STENCIL_LOOP_END);
+  if (start < _outer) {
+    _outerEnds.push_back({start, firstPatch, _code.size()});
+    return;
+  }
+  const Loop &loop = _loops[start];
+  // Forward: past the end of the loop. Backward: into the body.
+  target(loop.firstPatch, STENCIL_LOOP_START, _code.size());
+  target(firstPatch, STENCIL_LOOP_END, loop.body);
+}
+
+void CopyPatch::output() {
+  flushOffset();
+  emit(_counting ? STENCIL_OUTPUT_COUNTED : STENCIL_OUTPUT);
+}
+
+void CopyPatch::input() {
+  flushOffset();
+  emit(_counting ? STENCIL_INPUT_COUNTED : STENCIL_INPUT);
+}
+
+// Whether a hole is relative to where it is in the code.
+static bool isRelative(HoleKind kind) {
+  return kind != HoleKind::Abs64 && kind != HoleKind::PageOff12;
+}
+
+static uint32_t read32(const uint8_t* at) {
+  uint32_t value;
+  std::memcpy(&value, at, sizeof(value));
+  return value;
+}
+
+static void write32(uint8_t* at, uint32_t value) {
+  std::memcpy(at, &value, sizeof(value));
+}
+
+// Fills a single hole with the target address.
+static void patch(uint8_t* at, HoleKind kind, uint64_t target) {
+  uint64_t here = reinterpret_cast<uint64_t>(at);
+  int64_t relative = static_cast<int64_t>(target - here);
+  uint32_t instr = read32(at);
+  switch (kind) {
+    case HoleKind::Abs64:
+      std::memcpy(at, &target, sizeof(target));
+      return;
+    case HoleKind::Rel32:
+      assert(relative == static_cast<int32_t>(relative));
+      write32(at, static_cast<uint32_t>(relative));
+      return;
+    case HoleKind::Page21: {
+      int64_t pages = static_cast<int64_t>((target >> 12) - (here >> 12));
+      instr &= 0x9f00001fu;
+      instr |= (pages & 0x3) << 29;
+      instr |= ((pages >> 2) & 0x7ffff) << 5;
+      break;
+    }
+    case HoleKind::PageOff12:
+      // Only 64-bit loads go through slots, so the offset is scaled by 8.
+      instr &= ~(0xfffu << 10);
+      instr |= ((target & 0xfff) >> 3) << 10;
+      break;
+    case HoleKind::Branch26:
+      assert(reaches(kind, relative));
+      instr &= ~0x3ffffffu;
+      instr |= (relative >> 2) & 0x3ffffff;
+      break;
+    case HoleKind::Branch19:
+      assert(reaches(kind, relative));
+      instr &= ~(0x7ffffu << 5);
+      instr |= ((relative >> 2) & 0x7ffff) << 5;
+      break;
+    case HoleKind::Branch14:
+      assert(reaches(kind, relative));
+      instr &= ~(0x3fffu << 5);
+      instr |= ((relative >> 2) & 0x3fff) << 5;
+      break;
+  }
+  write32(at, instr);
+}
+
+// Writes a jump to an absolute address, for calls that may not reach.
+static void trampoline(uint8_t* at, uint64_t address) {
+  if (STENCIL_ARCH == StencilArch::X86_64) {
+    // jmp *0(%rip)
+    const uint8_t jmp[] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+    std::memcpy(at, jmp, sizeof(jmp));
+    std::memcpy(at + sizeof(jmp), &address, sizeof(address));
+  } else {
+    // ldr x16, #8
+    write32(at, 0x58000050u);
+    // br x16
+    write32(at + 4, 0xd61f0200u);
+    std::memcpy(at + 8, &address, sizeof(address));
+  }
+}
+
+void* CopyPatch::assemble() {
+  // The code is followed by trampolines and then by slots.
+  // Values that need either are collected first, such that the size is known.
+  // A slot is keyed on whether it holds a code offset and its value.
+  std::map<uint64_t, size_t> trampolines;
+  std::map<std::pair<bool, uint64_t>, size_t> slots;
+  size_t trampolineStart = (_code.size() + TRAMPOLINE_SIZE - 1)
+                           & ~(TRAMPOLINE_SIZE - 1);
+  for (const Patch &patch : _patches) {
+    bool code = patch.hole.value == HoleValue::Continue
+                || patch.hole.value == HoleValue::Target;
+    if (patch.hole.got) {
+      slots.emplace(std::make_pair(code, patch.value), 0);
+    } else if (!code && isRelative(patch.hole.kind)) {
+      trampolines.emplace(patch.value, 0);
+    }
+  }
+  size_t slotStart = trampolineStart + trampolines.size() * TRAMPOLINE_SIZE;
+  size_t size = slotStart + slots.size() * SLOT_SIZE;
+  _mappedBytes = size;
+
+  return mapExecutable(size, [&](uint8_t* base) {
+    std::memcpy(base, _code.data(), _code.size());
+    uint64_t address = reinterpret_cast<uint64_t>(base);
+    size_t offset = trampolineStart;
+    for (auto &entry : trampolines) {
+      entry.second = offset;
+      trampoline(base + offset, entry.first);
+      offset += TRAMPOLINE_SIZE;
+    }
+    for (auto &entry : slots) {
+      entry.second = offset;
+      uint64_t value = entry.first.second;
+      if (entry.first.first) {
+        value += address;
+      }
+      std::memcpy(base + offset, &value, sizeof(value));
+      offset += SLOT_SIZE;
+    }
+    for (const Patch &hole : _patches) {
+      bool code = hole.hole.value == HoleValue::Continue
+                  || hole.hole.value == HoleValue::Target;
+      uint64_t target;
+      if (hole.hole.got) {
+        target = address + slots[std::make_pair(code, hole.value)];
+      } else if (code) {
+        target = address + hole.value;
+      } else if (isRelative(hole.hole.kind)) {
+        target = address + trampolines[hole.value];
+      } else {
+        target = hole.value;
+      }
+      patch(base + hole.at, hole.hole.kind, target + hole.hole.addend);
+    }
+  });
+}
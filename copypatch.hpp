@@ -0,0 +1,147 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef copypatch_hpp
+#define copypatch_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "analysis.hpp"
+#include "cells.hpp"
+#include "stencil.hpp"
+
+// A compiler backend that copies clang-compiled stencils back to back and
+// patches their holes, instead of encoding instructions by hand.
+// This works on any architecture stencilgen can read the objects of.
+class CopyPatch {
+private:
+  // A hole in the copied code, filled in once the final address is known.
+  struct Patch {
+    size_t at;
+    Hole hole;
+    // An offset into the code for Continue and Target, otherwise the value.
+    uint64_t value;
+    // For a short branch that goes through an island, the patch of its b.
+    // Zero otherwise, the first patch is never one.
+    size_t veneer;
+  };
+
+  // An open loop.
+  struct Loop {
+    size_t firstPatch;
+    size_t body;
+  };
+
+  std::vector<uint8_t> _code;
+  std::vector<Patch> _patches;
+  std::vector<Loop> _loops;
+  // How many loops were opened before this fragment of the program, these
+  // come first in _loops but are only known once fragments are appended.
+  size_t _outer;
+  // The end of such a loop: which one, its first patch and what follows it.
+  struct OuterEnd {
+    size_t loop;
+    size_t firstPatch;
+    size_t after;
+  };
+  std::vector<OuterEnd> _outerEnds;
+  // Fuel charges, by the position of their ] and their first patch.
+  std::vector<std::pair<uint64_t, size_t>> _charges;
+  // Target holes of conditional branches since the last island, which reach
+  // less far than the code may grow.
+  std::vector<size_t> _shortTargets;
+  bool _counting;
+  bool _fueled;
+  size_t _stencils;
+  size_t _mappedBytes;
+  // How far the pointer moved since the last time it was written back.
+  int64_t _offset;
+
+  // Copies a stencil, returns the index of its first patch.
+  // The limit doubles as the position, no stencil has both.
+  size_t emit(const Stencil &stencil, uint64_t delta = 0, uint64_t limit = 0);
+
+  // Points the Target holes of a copied stencil at the given offset.
+  void target(size_t firstPatch, const Stencil &stencil, size_t offset);
+
+  // Appends a b to an offset into the code, returns its patch.
+  size_t branch(HoleValue value, uint64_t offset);
+
+  // Emits an island before the oldest short Target hole goes out of reach.
+  void keepInReach(size_t size);
+
+  // Branches over b's that the short Target holes since the last island go
+  // through, unless they are known to reach.
+  void island();
+
+  // Writes the pending offset back into the pointer.
+  void flushOffset();
+
+public:
+  CopyPatch(uintmax_t heuristic, bool counting = false, bool fueled = false);
+  void* assemble();
+
+  // A backend for a fragment of the program, which starts inside outer
+  // loops. Handles below outer stand for those, from the outermost.
+  CopyPatch fragment(uintmax_t heuristic, size_t outer) const;
+
+  // Appends fragments in order, each copied on its own thread.
+  // Their loops are numbered on from the loops here, one fragment after the
+  // other, and outer has the handles of the outer loops of each.
+  // Each fragment first writes its pointer back, as the next starts a loop.
+  void append(std::vector<CopyPatch> &fragments,
+              const std::vector<std::vector<size_t>> &outer);
+
+  // How many loops have a handle, including outer ones.
+  inline size_t loops() const {
+    return _loops.size();
+  }
+
+  // Sets what the fuel check before the ] at position charges.
+  void patchFuel(uint64_t position, uint64_t cost);
+
+  // The number of stencils copied so far.
+  inline size_t size() const {
+    return _stencils;
+  }
+
+  // The size of the code copied so far.
+  inline size_t bytes() const {
+    return _code.size();
+  }
+
+  // The size of the memory assemble mapped, with trampolines and slots.
+  inline size_t mappedBytes() const {
+    return _mappedBytes;
+  }
+
+  void prelude();
+  void postlude();
+  void updateCells(const std::vector<CellUpdate> &cells);
+  void movePointer(int64_t delta);
+  void guard(const Guard &range);
+  size_t loopStart(const Guard* once = nullptr);
+  void chargeFuel(uint64_t cost, uint64_t position);
+  void loopEnd(size_t start);
+  void output();
+  void input();
+};
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include "executable.hpp"
+
+void* mapExecutable(size_t size, const std::function<void(uint8_t*)> &fill) {
+#ifdef __APPLE__
+  // Create some executable memory, writable through the JIT write protection.
+  void* rawAddress = mmap(nullptr,
+                          size,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANON | MAP_JIT,
+                          -1,
+                          0);
+  if (__builtin_expect(rawAddress == MAP_FAILED, false)) {
+    return nullptr;
+  }
+  // Allow JIT writing.
+  pthread_jit_write_protect_np(0);
+  fill(reinterpret_cast<uint8_t*>(rawAddress));
+  // Disallow JIT writing again.
+  pthread_jit_write_protect_np(1);
+#else
+  // Elsewhere, write first and then flip the memory to executable.
+  void* rawAddress = mmap(nullptr,
+                          size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANON,
+                          -1,
+                          0);
+  if (__builtin_expect(rawAddress == MAP_FAILED, false)) {
+    return nullptr;
+  }
+  fill(reinterpret_cast<uint8_t*>(rawAddress));
+  if (__builtin_expect(mprotect(rawAddress, size, PROT_READ | PROT_EXEC) != 0,
+                       false)) {
+    munmap(rawAddress, size);
+    return nullptr;
+  }
+#endif
+  // Clear instruction cache.
+  char* charAddress = reinterpret_cast<char*>(rawAddress);
+  __builtin___clear_cache(charAddress, charAddress + size);
+  return rawAddress;
+}
+
+void unmapExecutable(void* address, size_t size) {
+  munmap(address, size);
+}
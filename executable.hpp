@@ -0,0 +1,34 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef executable_hpp
+#define executable_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Maps size bytes of executable memory. The fill function gets to write the
+// code at its final address before the memory becomes executable.
+// Returns nullptr if the memory could not be mapped.
+void* mapExecutable(size_t size, const std::function<void(uint8_t*)> &fill);
+
+// Unmaps memory from mapExecutable, given the same size.
+void unmapExecutable(void* address, size_t size);
+
+#endif
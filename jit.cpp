@@ -16,67 +16,157 @@
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
 #include <iostream>
-#include <sys/mman.h>
-#include "assembler.hpp"
+#include <memory>
+#include <string>
+#include <thread>
+#include "analysis.hpp"
+#include "backend.hpp"
 #include "constants.hpp"
 #include "compiler.hpp"
+#include "context.hpp"
+#include "stats.hpp"
+#include "transpiler.hpp"
 
 using std::uintmax_t;
 using std::fstream;
 
+// Compiles, assembles and runs the source with the backend the options choose.
+// Big sources are compiled in chunks on up to as many threads.
+// With fuel, the program stops once loops that may not end have spent it, or
+// with resume, gets the same amount again and continues.
+static int run(const std::string &source, const Analysis* analysis,
+               const BackendOptions &options, bool stats, bool resume,
+               unsigned threads, Stats &report) {
+  // Initialize to zero for compliance, vector updates may run past the end.
+  uint8_t memory[MEMORY_SIZE + VECTOR_CELLS] = {0};
+  Context context = {};
+  context.fuel = options.fuel;
+  JitFunction entry = compileProgram(source, analysis, options, stats,
+                                     threads, report).entry;
+  if (__builtin_expect(entry == nullptr, false)) {
+    std::cerr << "zero: could not JIT memory region" << std::endl;
+    return 1;
+  }
+
+  // Jump to the actual JIT subroutine.
+  PhaseTimer executeTimer;
+  int result = entry(memory, &context, memory);
+  while (result == EXIT_OUT_OF_FUEL && resume) {
+    report.preemptions++;
+    context.fuel = options.fuel;
+    result = entry(memory, &context, memory + context.pointer);
+  }
+  executeTimer.stop(report.execute);
+  if (result == EXIT_OUT_OF_FUEL) {
+    // Without guards, the pointer may have wandered off the memory.
+    std::cerr << "zero: out of fuel at position " << context.position
+              << ", pointer " << context.pointer;
+    if (context.pointer < MEMORY_SIZE) {
+      std::cerr << ", cell " << static_cast<int>(memory[context.pointer]);
+    }
+    std::cerr << std::endl;
+  }
+
+  report.bytesWritten = context.bytesWritten;
+  report.bytesRead = context.bytesRead;
+  return result;
+}
+
 // The main function takes in arguments and then executes the code.
 int main(int argc, char** argv) {
+  // Options come before the file, e.g. zero-jit --stats=json file.b.
+  bool stats = false;
+  bool json = false;
+  bool emitC = false;
+  bool resume = false;
+  BackendOptions options;
+  unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+  int arg = 1;
+  for (; arg < argc && std::strncmp(argv[arg], "--", 2) == 0; arg++) {
+    bool invalid = false;
+    if (parseBackendOption(argv[arg], options, invalid)) {
+      if (invalid) {
+        return 1;
+      }
+    } else if (std::strcmp(argv[arg], "--stats") == 0) {
+      stats = true;
+    } else if (std::strcmp(argv[arg], "--stats=json") == 0) {
+      stats = json = true;
+    } else if (std::strcmp(argv[arg], "--emit-c") == 0) {
+      emitC = true;
+    } else if (std::strncmp(argv[arg], "--threads=", 10) == 0) {
+      threads = std::strtoul(argv[arg] + 10, nullptr, 10);
+      if (threads == 0) {
+        std::cerr << "zero: threads have to be positive" << std::endl;
+        return 1;
+      }
+    } else if (std::strcmp(argv[arg], "--resume") == 0) {
+      resume = true;
+    } else {
+      std::cerr << "zero: unknown option " << argv[arg] << std::endl;
+      return 1;
+    }
+  }
+
   // We expect most of the time the program is provided.
-  if (__builtin_expect(argc < 2, false)) {
+  if (__builtin_expect(arg >= argc, false)) {
     std::cerr << "zero: please provide the input file" << std::endl;
     return 1;
   }
 
+  // Everything is zero until measured.
+  Stats report = {};
+
   // Get the file name, and consequently read the size of the file.
   // This may include comments, but these will just lead to wasted space.
-  char* fileName = argv[1];
+  PhaseTimer readTimer;
+  char* fileName = argv[arg];
   uintmax_t fileSize = std::filesystem::file_size(fileName);
-  // Perform a heuristic estimation of how many instructions we will need.
-  // Estimate 1 Assembly instruction per real instruction.
-  uintmax_t heuristic = fileSize;
-
-  // Create the memory and assembler.
-  uint8_t memory[MEMORY_SIZE] = {0}; // Initialize to zero for compliance.
-  // Use new since the constructor/destructor of Assembler take care of some
-  // kernel-level things needed to write JIT memory.
-  Assembler assembler(heuristic);
+  // Read the whole file up front, the compiler skips over comments.
+  std::string source(fileSize, '\0');
+  fstream file(fileName, fstream::in | fstream::binary);
+  file.read(source.data(), fileSize);
+  readTimer.stop(report.read);
 
-  // Write the prelude with the assembler.
-  assembler.prelude();
-
-  // Read the file line by line and write it to the address space.
-  char ch;
-  fstream file(fileName, fstream::in);
-
-  // Compile it via the compiler.
-  Compiler compiler(&assembler);
-  while (file >> ch) {
-    compiler.compile(ch);
+  // The analysis is only needed for guards and for reporting the tape size.
+  // It counts towards compiling.
+  PhaseTimer analyzeTimer;
+  PhaseTime analyze = {};
+  std::unique_ptr<Analysis> analysis;
+  if (options.safe || stats) {
+    analysis = std::make_unique<Analysis>(source);
+    report.tapeCells = analysis->tapeSize();
   }
-  compiler.flushCompilationBuffer();
+  const Analysis* guards = options.safe ? analysis.get() : nullptr;
+  analyzeTimer.stop(analyze);
 
-  // Write the postlude with the assembler.
-  assembler.postlude();
+  // Instead of running, write the program as C for an offline build.
+  if (emitC) {
+    Transpiler transpiler(options.fuel);
+    translate(transpiler, source, guards, report);
+    std::cout << transpiler.source();
+    return 0;
+  }
 
-  // Put everything into executable memory.
-  void* baseAddress = assembler.assemble();
-  if (__builtin_expect(baseAddress == nullptr, false)) {
-    std::cerr << "zero: could not JIT memory region" << std::endl;
-    return 1;
+  int result = run(source, guards, options, stats, resume, threads, report);
+  report.compile.wall += analyze.wall;
+  report.compile.cpu += analyze.cpu;
+  if (result == EXIT_OUT_OF_BOUNDS && options.safe) {
+    std::cerr << "zero: memory access out of bounds" << std::endl;
   }
 
-  // Jump to the actual JIT subroutine.
-  return reinterpret_cast<int(*)(void*)>(baseAddress)(memory);
+  // Statistics go to stderr such that they do not mix with the output.
+  if (stats) {
+    report.print(std::cerr, json);
+  }
+  return result;
 }
-
@@ -0,0 +1,188 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// zero-load: sends the same job to zero-serve over and over from a number of
+// connections at once, then reports throughput and latency.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "protocol.hpp"
+
+// Reads a whole file, for the program and its input.
+static bool readFile(const char* name, std::string &contents) {
+  std::ifstream file(name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Connects to the server, or returns -1.
+static int connectTo(const char* path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  std::strcpy(address.sun_path, path);
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) {
+    return -1;
+  }
+  if (connect(connection, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+// The latency at the given percentile, in milliseconds.
+static double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[index] * 1000;
+}
+
+int main(int argc, char** argv) {
+  const char* socketPath = DEFAULT_SOCKET;
+  const char* inputFile = nullptr;
+  unsigned connections = 4;
+  uint64_t jobs = 1000;
+  int arg = 1;
+  for (; arg < argc && std::strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (std::strncmp(argv[arg], "--socket=", 9) == 0) {
+      socketPath = argv[arg] + 9;
+    } else if (std::strncmp(argv[arg], "--input=", 8) == 0) {
+      inputFile = argv[arg] + 8;
+    } else if (std::strncmp(argv[arg], "--connections=", 14) == 0) {
+      connections = std::strtoul(argv[arg] + 14, nullptr, 10);
+    } else if (std::strncmp(argv[arg], "--jobs=", 7) == 0) {
+      jobs = std::strtoull(argv[arg] + 7, nullptr, 10);
+    } else {
+      std::cerr << "zero: unknown option " << argv[arg] << std::endl;
+      return 1;
+    }
+  }
+  if (arg >= argc) {
+    std::cerr << "zero: please provide the program to send" << std::endl;
+    return 1;
+  }
+  if (connections == 0 || jobs == 0) {
+    std::cerr << "zero: connections and jobs have to be positive"
+              << std::endl;
+    return 1;
+  }
+  std::string program;
+  std::string input;
+  if (!readFile(argv[arg], program)
+      || (inputFile != nullptr && !readFile(inputFile, input))) {
+    std::cerr << "zero: could not read the program or input" << std::endl;
+    return 1;
+  }
+
+  // One request, sent as is for every job.
+  JobRequest request = {static_cast<uint32_t>(program.size()),
+                        static_cast<uint32_t>(input.size())};
+  std::string message(reinterpret_cast<const char*>(&request),
+                      sizeof(request));
+  message += program;
+  message += input;
+
+  // Every connection sends its share of the jobs one after the other.
+  std::vector<std::vector<double>> latencies(connections);
+  std::atomic<uint64_t> failed(0);
+  std::atomic<uint64_t> compiled(0);
+  std::atomic<uint64_t> executeNanos(0);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < connections; i++) {
+    uint64_t share = jobs / connections + (i < jobs % connections);
+    threads.emplace_back([&, i, share]() {
+      int connection = connectTo(socketPath);
+      if (connection < 0) {
+        failed += share;
+        return;
+      }
+      std::string output;
+      for (uint64_t job = 0; job < share; job++) {
+        auto sent = std::chrono::steady_clock::now();
+        JobResponse response;
+        if (!writeFully(connection, message.data(), message.size())
+            || !readFully(connection, &response, sizeof(response))) {
+          failed += share - job;
+          break;
+        }
+        output.resize(response.outputSize);
+        if (!readFully(connection, output.data(), output.size())) {
+          failed += share - job;
+          break;
+        }
+        std::chrono::duration<double> latency =
+          std::chrono::steady_clock::now() - sent;
+        latencies[i].push_back(latency.count());
+        failed += response.result != 0;
+        compiled += response.compileNanos != 0;
+        executeNanos += response.executeNanos;
+      }
+      close(connection);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now()
+                                       - start;
+
+  std::vector<double> all;
+  for (const std::vector<double> &some : latencies) {
+    all.insert(all.end(), some.begin(), some.end());
+  }
+  std::sort(all.begin(), all.end());
+  double done = static_cast<double>(all.size());
+  std::cout << "zero: load\n"
+            << "  jobs: " << all.size() << "\n"
+            << "  failed: " << failed << "\n"
+            << "  compiled: " << compiled << "\n"
+            << "  connections: " << connections << "\n"
+            << "  wall: " << wall.count() * 1000 << " ms\n"
+            << "  jobs_per_second: " << done / wall.count() << "\n"
+            << "  execute_mean: "
+            << (done > 0 ? executeNanos / done / 1e6 : 0) << " ms\n"
+            << "  p50: " << percentile(all, 50) << " ms\n"
+            << "  p99: " << percentile(all, 99) << " ms\n"
+            << "  max: " << percentile(all, 100) << " ms\n";
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef protocol_hpp
+#define protocol_hpp
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+
+// How zero-serve and its clients talk over a Unix domain socket.
+// A connection carries any number of jobs, one after the other. Both sides
+// run on the same machine, so the headers are sent as they are in memory.
+
+// Where the server listens unless told otherwise.
+constexpr const char* DEFAULT_SOCKET = "/tmp/zero.sock";
+
+// Programs and inputs beyond this are refused.
+constexpr uint32_t MAX_JOB_BYTES = 1u << 26;
+
+// A job, followed by the program and then the input.
+struct JobRequest {
+  uint32_t programSize;
+  uint32_t inputSize;
+};
+
+// The outcome of a job, followed by the output.
+// The result is the exit code of the JIT, or 1 if the job was refused.
+struct JobResponse {
+  int32_t result;
+  uint32_t outputSize;
+  // Zero if the program came from the cache.
+  uint64_t compileNanos;
+  uint64_t executeNanos;
+  // Instructions for the AArch64 backend, stencils for copy-and-patch.
+  uint64_t ops;
+  uint64_t bytesWritten;
+  uint64_t bytesRead;
+};
+
+// Reads exactly size bytes, false on an error or when the peer hung up.
+inline bool readFully(int fd, void* data, size_t size) {
+  uint8_t* at = static_cast<uint8_t*>(data);
+  while (size > 0) {
+    ssize_t count = read(fd, at, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    at += count;
+    size -= count;
+  }
+  return true;
+}
+
+// Writes exactly size bytes, false on an error.
+inline bool writeFully(int fd, const void* data, size_t size) {
+  const uint8_t* at = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    ssize_t count = write(fd, at, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    at += count;
+    size -= count;
+  }
+  return true;
+}
+
+#endif
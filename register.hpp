@@ -32,22 +32,44 @@ public:
 };
 
 // Special register allocation as follows:
+// x5  - bytes written so far (only when counting).
+// x6  - bytes read so far (only when counting).
+// x7  - the address of the shared context.
+// x8  - the syscall number on Linux.
 // x9  - the base address of the memory cells.
 // x10 - the memory address index.
 // x11 - constant holding +1.
 // x12 - constant holding -1.
 // x13 - scratch.
 // x14 - scratch.
+// x15 - fuel left (only when fueled).
+// x16 - the syscall number on macOS.
+// x17 - scratch.
+// v0  - vector scratch, the cells.
+// v1  - vector scratch, which cells to clear.
+// v2  - vector scratch, what to add to the cells.
 const Register x0(0u);
 const Register x1(1u);
 const Register x2(2u);
+const Register bytesOut(5u);
+const Register bytesIn(6u);
+const Register context(7u);
 const Register memBase(9u);
 const Register memPtr(10u);
 const Register constOne(11u);
 const Register constNegOne(12u);
 const Register tmp1(13u);
 const Register tmp2(14u);
+const Register fuelLeft(15u);
+#ifdef __APPLE__
 const Register sys(16u);
+#else
+const Register sys(8u);
+#endif
+const Register tmp3(17u);
 const Register xzr_sp(31u);
+const Register vecCells(0u);
+const Register vecClear(1u);
+const Register vecAdd(2u);
 
 #endif
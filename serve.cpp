@@ -0,0 +1,496 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// zero-serve: runs Brainfuck jobs sent over a Unix domain socket.
+// Every distinct program is compiled once into a cache shared by a pool of
+// workers. Each worker keeps its own memory and I/O files between jobs, such
+// that a job costs little more than running the compiled code.
+// The main thread waits for connections with a job in them, a worker takes
+// one job at a time and then hands the connection back.
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <queue>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "analysis.hpp"
+#include "backend.hpp"
+#include "constants.hpp"
+#include "context.hpp"
+#include "executable.hpp"
+#include "protocol.hpp"
+#include "stats.hpp"
+
+// Jobs are untrusted, so by default they are guarded and get this much fuel,
+// enough for mandelbrot.b. --unsafe and --no-fuel turn either off.
+constexpr int64_t DEFAULT_JOB_FUEL = 1ll << 32;
+
+// How many MiB of sources and code the cache keeps by default.
+constexpr size_t DEFAULT_CACHE_MIB = 256;
+
+// How the server compiles and runs every job.
+struct Options {
+  const char* socket;
+  unsigned workers;
+  size_t cacheBytes;
+  BackendOptions backend;
+};
+
+// A program compiled once and shared by all workers.
+// The code is unmapped once the cache dropped it and no job runs it anymore.
+struct Program {
+  std::shared_ptr<void> code;
+  JitFunction entry;
+  size_t bytes;
+  uint64_t ops;
+  uint64_t compileNanos;
+};
+
+static uint64_t nanos(const PhaseTime &phase) {
+  return static_cast<uint64_t>(phase.wall * 1e9);
+}
+
+// Whether the brackets match, the compiler assumes they do.
+static bool balanced(const std::string &source) {
+  int64_t depth = 0;
+  for (char ch : source) {
+    depth += (ch == '[') - (ch == ']');
+    if (depth < 0) {
+      return false;
+    }
+  }
+  return depth == 0;
+}
+
+// Compiles and assembles on the worker's thread.
+static Program compile(const std::string &source, const Options &options) {
+  PhaseTimer timer;
+  std::unique_ptr<Analysis> analysis;
+  if (options.backend.safe) {
+    analysis = std::make_unique<Analysis>(source);
+  }
+  Stats report = {};
+  // Always count, such that every job can report its I/O.
+  CompiledProgram compiled = compileProgram(source, analysis.get(),
+                                            options.backend, true, 1, report);
+  PhaseTime time;
+  timer.stop(time);
+  if (compiled.entry == nullptr) {
+    return {};
+  }
+  size_t bytes = compiled.mappedBytes;
+  std::shared_ptr<void> code(reinterpret_cast<void*>(compiled.entry),
+                             [bytes](void* address) {
+                               unmapExecutable(address, bytes);
+                             });
+  return {code, compiled.entry, bytes, report.ops, nanos(time)};
+}
+
+// Compiled programs by their source.
+// The first job with a program compiles it, others with the same program
+// wait for that instead of compiling it again.
+// Once the sources and code take more than the limit, the programs used
+// least recently are dropped, those still compiling stay.
+class ProgramCache {
+private:
+  // A program, how much it takes once compiled, and where it is in _recent.
+  struct Entry {
+    std::shared_future<Program> program;
+    size_t bytes;
+    std::list<const std::string*>::iterator recent;
+  };
+
+  const Options &_options;
+  std::mutex _mutex;
+  std::unordered_map<std::string, Entry> _programs;
+  // The sources, the one used last first.
+  std::list<const std::string*> _recent;
+  size_t _bytes;
+
+  // Drops programs until the cache fits its limit, with the lock held.
+  void evict() {
+    auto source = _recent.end();
+    while (_bytes > _options.cacheBytes && source != _recent.begin()) {
+      source--;
+      auto found = _programs.find(**source);
+      if (found->second.bytes == 0) {
+        continue;
+      }
+      _bytes -= found->second.bytes;
+      source = _recent.erase(source);
+      _programs.erase(found);
+    }
+  }
+
+public:
+  ProgramCache(const Options &options) : _options(options), _bytes(0u) {}
+
+  // Sets compiled if this call did the compiling.
+  Program get(const std::string &source, bool &compiled) {
+    std::promise<Program> promise;
+    std::shared_future<Program> future;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto found = _programs.find(source);
+      compiled = found == _programs.end();
+      if (compiled) {
+        future = promise.get_future().share();
+        found = _programs.emplace(source, Entry{future, 0u, {}}).first;
+        _recent.push_front(&found->first);
+        found->second.recent = _recent.begin();
+      } else {
+        future = found->second.program;
+        _recent.splice(_recent.begin(), _recent, found->second.recent);
+      }
+    }
+    if (!compiled) {
+      return future.get();
+    }
+    // Compile outside of the lock, other programs need not wait.
+    // A program that cannot be compiled, e.g. for lack of memory, is refused
+    // for the jobs waiting on it as well.
+    Program program = {};
+    try {
+      program = compile(source, _options);
+    } catch (const std::exception &error) {
+      std::cerr << "zero: could not compile a program: " << error.what()
+                << std::endl;
+    }
+    promise.set_value(program);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _programs.find(source);
+    if (program.entry == nullptr) {
+      // Let the next job try again.
+      _recent.erase(found->second.recent);
+      _programs.erase(found);
+    } else {
+      found->second.bytes = source.size() + program.bytes;
+      _bytes += found->second.bytes;
+      evict();
+    }
+    return program;
+  }
+};
+
+// Runs jobs one at a time, reusing everything it can between them.
+class Worker {
+private:
+  ProgramCache &_cache;
+  const Options &_options;
+  std::vector<uint8_t> _memory;
+  // The JIT code does its I/O with plain syscalls, so jobs get files.
+  FILE* _in;
+  FILE* _out;
+  std::string _source;
+  std::string _input;
+  std::string _output;
+
+  // Runs a single job, its output ends up in _output.
+  JobResponse run(const std::string &source, const std::string &input) {
+    JobResponse response = {};
+    _output.clear();
+    if (!balanced(source)) {
+      response.result = 1;
+      return response;
+    }
+    bool compiled = false;
+    Program program = _cache.get(source, compiled);
+    if (__builtin_expect(program.entry == nullptr, false)) {
+      response.result = 1;
+      return response;
+    }
+    response.compileNanos = compiled ? program.compileNanos : 0u;
+    response.ops = program.ops;
+
+    // Every job starts with zeroed memory and fresh files.
+    std::fill(_memory.begin(), _memory.end(), 0u);
+    int in = fileno(_in);
+    int out = fileno(_out);
+    if (ftruncate(in, 0) != 0 || ftruncate(out, 0) != 0
+        || !writeFully(in, input.data(), input.size())
+        || lseek(in, 0, SEEK_SET) != 0 || lseek(out, 0, SEEK_SET) != 0) {
+      response.result = 1;
+      return response;
+    }
+    Context context = {};
+    context.fuel = _options.backend.fuel;
+    context.inFd = in;
+    context.outFd = out;
+
+    PhaseTimer timer;
+    response.result = program.entry(_memory.data(), &context, _memory.data());
+    PhaseTime time;
+    timer.stop(time);
+    response.executeNanos = nanos(time);
+    response.bytesWritten = context.bytesWritten;
+    response.bytesRead = context.bytesRead;
+
+    off_t size = lseek(out, 0, SEEK_END);
+    _output.resize(size > 0 ? size : 0);
+    if (lseek(out, 0, SEEK_SET) != 0
+        || !readFully(out, _output.data(), _output.size())) {
+      _output.clear();
+    }
+    response.outputSize = _output.size();
+    return response;
+  }
+
+public:
+  Worker(ProgramCache &cache, const Options &options)
+    : _cache(cache), _options(options),
+      _memory(MEMORY_SIZE + VECTOR_CELLS), _in(std::tmpfile()),
+      _out(std::tmpfile()) {}
+
+  ~Worker() {
+    if (_in != nullptr) {
+      std::fclose(_in);
+    }
+    if (_out != nullptr) {
+      std::fclose(_out);
+    }
+  }
+
+  // Whether the worker got its files.
+  inline bool ready() const {
+    return _in != nullptr && _out != nullptr;
+  }
+
+  // Serves the next job of a connection.
+  // Returns false if the client hung up or broke the protocol.
+  bool serve(int connection) {
+    JobRequest request;
+    if (!readFully(connection, &request, sizeof(request))
+        || request.programSize > MAX_JOB_BYTES
+        || request.inputSize > MAX_JOB_BYTES) {
+      return false;
+    }
+    _source.resize(request.programSize);
+    _input.resize(request.inputSize);
+    if (!readFully(connection, _source.data(), _source.size())
+        || !readFully(connection, _input.data(), _input.size())) {
+      return false;
+    }
+    JobResponse response = run(_source, _input);
+    return writeFully(connection, &response, sizeof(response))
+           && writeFully(connection, _output.data(), _output.size());
+  }
+};
+
+// Hands connections with a job waiting to the workers, and takes them back.
+class Dispatcher {
+private:
+  std::mutex _mutex;
+  std::condition_variable _pending;
+  // Ready for a worker.
+  std::queue<int> _jobs;
+  // Done by a worker, to be watched again.
+  std::vector<int> _returned;
+  // Wakes up the poll when a connection is returned.
+  int _wake[2];
+
+public:
+  Dispatcher() : _wake{-1, -1} {}
+
+  // Creates the wake up pipe, false if that failed.
+  bool open() {
+    return pipe(_wake) == 0
+           && fcntl(_wake[0], F_SETFL, O_NONBLOCK) == 0;
+  }
+
+  // The end of the wake up pipe to watch.
+  inline int wakeFd() const {
+    return _wake[0];
+  }
+
+  // Queues a connection for the next free worker.
+  void push(int connection) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push(connection);
+    }
+    _pending.notify_one();
+  }
+
+  // Waits for a connection with a job.
+  int pop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _pending.wait(lock, [this]() { return !_jobs.empty(); });
+    int connection = _jobs.front();
+    _jobs.pop();
+    return connection;
+  }
+
+  // Gives a connection back to be watched for its next job.
+  void giveBack(int connection) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _returned.push_back(connection);
+    }
+    char byte = 0;
+    writeFully(_wake[1], &byte, 1);
+  }
+
+  // Moves the returned connections into the watched ones.
+  void takeBack(std::vector<pollfd> &watched) {
+    char bytes[64];
+    while (read(_wake[0], bytes, sizeof(bytes)) > 0) {}
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int connection : _returned) {
+      watched.push_back({connection, POLLIN, 0});
+    }
+    _returned.clear();
+  }
+};
+
+int main(int argc, char** argv) {
+  unsigned cores = std::thread::hardware_concurrency();
+  Options options = {DEFAULT_SOCKET, cores > 0 ? cores : 1u,
+                     DEFAULT_CACHE_MIB << 20, {}};
+  options.backend.safe = true;
+  options.backend.fuel = DEFAULT_JOB_FUEL;
+  for (int arg = 1; arg < argc; arg++) {
+    bool invalid = false;
+    if (parseBackendOption(argv[arg], options.backend, invalid)) {
+      if (invalid) {
+        return 1;
+      }
+    } else if (std::strcmp(argv[arg], "--unsafe") == 0) {
+      options.backend.safe = false;
+    } else if (std::strcmp(argv[arg], "--no-fuel") == 0) {
+      options.backend.fuel = 0;
+    } else if (std::strncmp(argv[arg], "--cache=", 8) == 0) {
+      options.cacheBytes = std::strtoull(argv[arg] + 8, nullptr, 10) << 20;
+    } else if (std::strncmp(argv[arg], "--socket=", 9) == 0) {
+      options.socket = argv[arg] + 9;
+    } else if (std::strncmp(argv[arg], "--workers=", 10) == 0) {
+      options.workers = std::strtoul(argv[arg] + 10, nullptr, 10);
+    } else {
+      std::cerr << "zero: unknown option " << argv[arg] << std::endl;
+      return 1;
+    }
+  }
+  if (options.workers == 0) {
+    std::cerr << "zero: workers have to be positive" << std::endl;
+    return 1;
+  }
+
+  // Clients that hang up early should not take the server with them.
+  signal(SIGPIPE, SIG_IGN);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(options.socket) >= sizeof(address.sun_path)) {
+    std::cerr << "zero: socket path too long" << std::endl;
+    return 1;
+  }
+  std::strcpy(address.sun_path, options.socket);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(options.socket);
+  if (listener < 0
+      || bind(listener, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) != 0
+      || listen(listener, SOMAXCONN) != 0) {
+    std::cerr << "zero: could not listen on " << options.socket << ": "
+              << std::strerror(errno) << std::endl;
+    return 1;
+  }
+
+  Dispatcher dispatcher;
+  if (!dispatcher.open()) {
+    std::cerr << "zero: could not create a pipe" << std::endl;
+    return 1;
+  }
+  ProgramCache cache(options);
+  for (unsigned i = 0; i < options.workers; i++) {
+    std::thread([&]() {
+      Worker worker(cache, options);
+      if (!worker.ready()) {
+        std::cerr << "zero: could not create worker files" << std::endl;
+        _exit(1);
+      }
+      for (;;) {
+        int connection = dispatcher.pop();
+        if (worker.serve(connection)) {
+          dispatcher.giveBack(connection);
+        } else {
+          close(connection);
+        }
+      }
+    }).detach();
+  }
+  std::cerr << "zero: serving on " << options.socket << " with "
+            << options.workers << " workers" << std::endl;
+
+  // The listener and the wake up pipe come first, then the connections that
+  // are not with a worker.
+  std::vector<pollfd> watched = {{listener, POLLIN, 0},
+                                 {dispatcher.wakeFd(), POLLIN, 0}};
+  for (;;) {
+    if (poll(watched.data(), watched.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "zero: poll failed: " << std::strerror(errno) << std::endl;
+      // The workers still use what lives on this stack, so do not unwind it.
+      _exit(1);
+    }
+    // A worker finds out whether a connection has a job or hung up.
+    size_t kept = 2;
+    for (size_t i = 2; i < watched.size(); i++) {
+      if (watched[i].revents != 0) {
+        dispatcher.push(watched[i].fd);
+      } else {
+        watched[kept++] = watched[i];
+      }
+    }
+    bool accepting = watched[0].revents != 0;
+    bool returned = watched[1].revents != 0;
+    watched.resize(kept);
+    if (returned) {
+      dispatcher.takeBack(watched);
+    }
+    if (accepting) {
+      int connection = accept(listener, nullptr, nullptr);
+      if (connection >= 0) {
+        watched.push_back({connection, POLLIN, 0});
+      } else if (errno != EINTR && errno != ECONNABORTED) {
+        std::cerr << "zero: accept failed: " << std::strerror(errno)
+                  << std::endl;
+        _exit(1);
+      }
+    }
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.hpp"
+
+PhaseTimer::PhaseTimer()
+  : _wall(std::chrono::steady_clock::now()), _cpu(std::clock()) {}
+
+void PhaseTimer::stop(PhaseTime &phase) const {
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - _wall;
+  phase.wall = wall.count();
+  phase.cpu = static_cast<double>(std::clock() - _cpu) / CLOCKS_PER_SEC;
+}
+
+// Prints a single phase, times are in milliseconds.
+static void printPhase(std::ostream &out, const char* name,
+                       const PhaseTime &phase, bool json) {
+  if (json) {
+    out << "\"" << name << "\":{\"wall_ms\":" << phase.wall * 1000
+        << ",\"cpu_ms\":" << phase.cpu * 1000 << "},";
+  } else {
+    out << "  " << name << ": " << phase.wall * 1000 << " ms wall, "
+        << phase.cpu * 1000 << " ms cpu\n";
+  }
+}
+
+// Prints a single counter, the last one does not get a trailing comma.
+static void printCounter(std::ostream &out, const char* name,
+                         uint64_t value, bool json, bool last = false) {
+  if (json) {
+    out << "\"" << name << "\":" << value << (last ? "" : ",");
+  } else {
+    out << "  " << name << ": " << value << "\n";
+  }
+}
+
+void Stats::print(std::ostream &out, bool json) const {
+  out << (json ? "{" : "zero: stats\n");
+  printPhase(out, "read", read, json);
+  printPhase(out, "compile", compile, json);
+  printPhase(out, "assemble", assemble, json);
+  printPhase(out, "execute", execute, json);
+  printCounter(out, "commands", commands, json);
+  printCounter(out, "chunks", chunks, json);
+  printCounter(out, "ops", ops, json);
+  printCounter(out, "code_bytes", codeBytes, json);
+  printCounter(out, "loops", loops, json);
+  printCounter(out, "clear_loops", clearLoops, json);
+  printCounter(out, "guards", guards, json);
+  printCounter(out, "tape_cells", tapeCells, json);
+  printCounter(out, "preemptions", preemptions, json);
+  printCounter(out, "bytes_written", bytesWritten, json);
+  printCounter(out, "bytes_read", bytesRead, json, true);
+  out << (json ? "}\n" : "");
+}
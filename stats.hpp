@@ -0,0 +1,69 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef stats_hpp
+#define stats_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <ostream>
+
+// The wall and CPU time spent in a single phase, in seconds.
+struct PhaseTime {
+  double wall;
+  double cpu;
+};
+
+// Measures the time between construction and stop.
+class PhaseTimer {
+private:
+  std::chrono::steady_clock::time_point _wall;
+  std::clock_t _cpu;
+
+public:
+  PhaseTimer();
+
+  // Writes the elapsed time into the phase.
+  void stop(PhaseTime &phase) const;
+};
+
+// Everything reported by --stats.
+struct Stats {
+  PhaseTime read;
+  PhaseTime compile;
+  PhaseTime assemble;
+  PhaseTime execute;
+  uint64_t commands;
+  uint64_t chunks;
+  // Instructions for the AArch64 backend, stencils for copy-and-patch.
+  uint64_t ops;
+  uint64_t codeBytes;
+  uint64_t loops;
+  uint64_t clearLoops;
+  uint64_t guards;
+  uint64_t tapeCells;
+  uint64_t preemptions;
+  uint64_t bytesWritten;
+  uint64_t bytesRead;
+
+  // Prints the statistics, either human readable or as a JSON object.
+  void print(std::ostream &out, bool json) const;
+};
+
+#endif
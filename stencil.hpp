@@ -0,0 +1,74 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef stencil_hpp
+#define stencil_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+// Shared between stencilgen, which writes the stencil tables at build time,
+// and the copy-and-patch backend, which reads them.
+
+// The architecture the stencils were compiled for.
+enum class StencilArch : uint8_t {
+  X86_64,
+  AArch64,
+};
+
+// How a hole is encoded in the code, i.e. the relocation type.
+enum class HoleKind : uint8_t {
+  Abs64,     // 64-bit absolute address.
+  Rel32,     // x86-64 32-bit PC relative displacement.
+  Page21,    // AArch64 adrp, 4K page relative.
+  PageOff12, // AArch64 64-bit ldr, offset in page scaled by 8.
+  Branch26,  // AArch64 b and bl.
+  Branch19,  // AArch64 b.cond, cbz and cbnz.
+  Branch14,  // AArch64 tbz and tbnz.
+};
+
+// What a hole gets filled with.
+enum class HoleValue : uint8_t {
+  Continue, // The stencil after this one.
+  Target,   // The other side of a loop.
+  Delta,    // A constant, the cell or pointer delta.
+  Limit,    // A second constant, the limit of a guard.
+  Position, // Where in the source a stencil came from.
+  Write,    // The write function.
+  Read,     // The read function.
+};
+
+// A single hole in a stencil.
+struct Hole {
+  uint32_t offset;
+  HoleKind kind;
+  HoleValue value;
+  // Whether the code refers to a slot holding the value instead.
+  bool got;
+  int64_t addend;
+};
+
+// A compiled stencil: code with holes.
+struct Stencil {
+  const uint8_t* code;
+  uint32_t size;
+  const Hole* holes;
+  uint32_t holeCount;
+};
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Build time tool: reads the object file the stencils were compiled into and
+// writes the stencil code and holes as a C++ header to stdout.
+// Understands ELF (x86-64 and AArch64) and Mach-O (AArch64) objects.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "stencil.hpp"
+
+// A relocation inside a stencil, before the symbol is mapped to a hole.
+struct Relocation {
+  uint32_t offset;
+  HoleKind kind;
+  bool got;
+  int64_t addend;
+  std::string symbol;
+};
+
+// A stencil as found in the object file.
+struct Function {
+  std::string name;
+  std::vector<uint8_t> code;
+  std::vector<Relocation> relocations;
+};
+
+// Reads a little endian value at the given offset, checking the bounds.
+template <class T>
+static T read(const std::vector<uint8_t> &file, uint64_t offset) {
+  if (offset + sizeof(T) > file.size()) {
+    throw std::runtime_error("truncated object file");
+  }
+  T value;
+  std::memcpy(&value, file.data() + offset, sizeof(T));
+  return value;
+}
+
+static std::string readString(const std::vector<uint8_t> &file,
+                              uint64_t offset) {
+  if (offset >= file.size()) {
+    throw std::runtime_error("truncated object file");
+  }
+  const char* start = reinterpret_cast<const char*>(file.data() + offset);
+  return std::string(start, strnlen(start, file.size() - offset));
+}
+
+// Only functions named like this are stencils.
+static bool isStencil(const std::string &name) {
+  return name.rfind("stencil_", 0) == 0;
+}
+
+// Maps an ELF relocation type to how it is patched.
+static Relocation elfRelocation(uint16_t machine, uint32_t type) {
+  // x86-64.
+  if (machine == 62) {
+    switch (type) {
+      case 1: return {0, HoleKind::Abs64, false, 0, ""};   // R_X86_64_64
+      case 2:                                              // R_X86_64_PC32
+      case 4: return {0, HoleKind::Rel32, false, 0, ""};   // R_X86_64_PLT32
+      case 9:                                              // R_X86_64_GOTPCREL
+      case 41:                                             // ..._GOTPCRELX
+      case 42: return {0, HoleKind::Rel32, true, 0, ""};   // ..._REX_GOTPCRELX
+    }
+  }
+  // AArch64.
+  if (machine == 183) {
+    switch (type) {
+      case 257: return {0, HoleKind::Abs64, false, 0, ""};    // ABS64
+      case 279: return {0, HoleKind::Branch14, false, 0, ""}; // TSTBR14
+      case 280: return {0, HoleKind::Branch19, false, 0, ""}; // CONDBR19
+      case 282:                                               // JUMP26
+      case 283: return {0, HoleKind::Branch26, false, 0, ""}; // CALL26
+      case 311: return {0, HoleKind::Page21, true, 0, ""};    // ADR_GOT_PAGE
+      case 312: return {0, HoleKind::PageOff12, true, 0, ""}; // LD64_GOT_LO12
+    }
+  }
+  throw std::runtime_error("unsupported ELF relocation " + std::to_string(type));
+}
+
+// Reads the stencils out of an ELF64 relocatable object.
+static std::vector<Function> readElf(const std::vector<uint8_t> &file,
+                                     StencilArch &arch) {
+  uint16_t machine = read<uint16_t>(file, 18);
+  if (machine == 62) {
+    arch = StencilArch::X86_64;
+  } else if (machine == 183) {
+    arch = StencilArch::AArch64;
+  } else {
+    throw std::runtime_error("unsupported ELF machine");
+  }
+  uint64_t shoff = read<uint64_t>(file, 40);
+  uint16_t shentsize = read<uint16_t>(file, 58);
+  uint16_t shnum = read<uint16_t>(file, 60);
+  auto section = [&](uint32_t index, uint32_t field) {
+    return shoff + index * shentsize + field;
+  };
+
+  // Find the symbol table, there is only one in a relocatable object.
+  uint32_t symtab = 0;
+  for (uint32_t i = 0; i < shnum; i++) {
+    if (read<uint32_t>(file, section(i, 4)) == 2) { // SHT_SYMTAB
+      symtab = i;
+    }
+  }
+  if (symtab == 0) {
+    throw std::runtime_error("no symbol table");
+  }
+  uint64_t symOffset = read<uint64_t>(file, section(symtab, 24));
+  uint64_t symSize = read<uint64_t>(file, section(symtab, 32));
+  uint32_t strtab = read<uint32_t>(file, section(symtab, 40));
+  uint64_t strOffset = read<uint64_t>(file, section(strtab, 24));
+  auto symbol = [&](uint64_t index, uint32_t field) {
+    return symOffset + index * 24 + field;
+  };
+  auto symbolName = [&](uint64_t index) {
+    return readString(file, strOffset + read<uint32_t>(file, symbol(index, 0)));
+  };
+
+  std::vector<Function> functions;
+  for (uint64_t i = 0; i < symSize / 24; i++) {
+    std::string name = symbolName(i);
+    uint8_t type = read<uint8_t>(file, symbol(i, 4)) & 0xf;
+    if (type != 2 || !isStencil(name)) { // STT_FUNC
+      continue;
+    }
+    uint16_t index = read<uint16_t>(file, symbol(i, 6));
+    uint64_t value = read<uint64_t>(file, symbol(i, 8));
+    uint64_t size = read<uint64_t>(file, symbol(i, 16));
+    uint64_t start = read<uint64_t>(file, section(index, 24)) + value;
+    if (start + size > file.size()) {
+      throw std::runtime_error("truncated object file");
+    }
+    Function function;
+    function.name = name;
+    function.code.assign(file.begin() + start, file.begin() + start + size);
+    // Collect the relocations that apply to this function.
+    for (uint32_t j = 0; j < shnum; j++) {
+      if (read<uint32_t>(file, section(j, 4)) != 4 // SHT_RELA
+          || read<uint32_t>(file, section(j, 44)) != index) {
+        continue;
+      }
+      uint64_t relOffset = read<uint64_t>(file, section(j, 24));
+      uint64_t relSize = read<uint64_t>(file, section(j, 32));
+      for (uint64_t k = 0; k < relSize / 24; k++) {
+        uint64_t at = read<uint64_t>(file, relOffset + k * 24);
+        uint64_t info = read<uint64_t>(file, relOffset + k * 24 + 8);
+        if (at < value || at >= value + size) {
+          continue;
+        }
+        Relocation relocation = elfRelocation(machine, info & 0xffffffff);
+        relocation.offset = at - value;
+        relocation.addend = read<int64_t>(file, relOffset + k * 24 + 16);
+        relocation.symbol = symbolName(info >> 32);
+        function.relocations.push_back(relocation);
+      }
+    }
+    functions.push_back(function);
+  }
+  return functions;
+}
+
+// Reads the stencils out of a Mach-O 64 object, only AArch64 is supported.
+static std::vector<Function> readMachO(const std::vector<uint8_t> &file,
+                                       StencilArch &arch) {
+  if (read<uint32_t>(file, 4) != 0x0100000c) { // CPU_TYPE_ARM64
+    throw std::runtime_error("unsupported Mach-O CPU type");
+  }
+  arch = StencilArch::AArch64;
+  uint32_t ncmds = read<uint32_t>(file, 16);
+
+  // Find the text section and the symbol table.
+  uint64_t textAddr = 0, textSize = 0, textOffset = 0;
+  uint32_t relOffset = 0, relCount = 0, textIndex = 0, sections = 0;
+  uint32_t symOffset = 0, symCount = 0, strOffset = 0;
+  uint64_t command = 32;
+  for (uint32_t i = 0; i < ncmds; i++) {
+    uint32_t cmd = read<uint32_t>(file, command);
+    if (cmd == 0x19) { // LC_SEGMENT_64
+      uint32_t nsects = read<uint32_t>(file, command + 64);
+      for (uint32_t j = 0; j < nsects; j++) {
+        uint64_t sect = command + 72 + j * 80;
+        sections++;
+        if (readString(file, sect).substr(0, 16) == "__text") {
+          textIndex = sections;
+          textAddr = read<uint64_t>(file, sect + 32);
+          textSize = read<uint64_t>(file, sect + 40);
+          textOffset = read<uint32_t>(file, sect + 48);
+          relOffset = read<uint32_t>(file, sect + 56);
+          relCount = read<uint32_t>(file, sect + 60);
+        }
+      }
+    } else if (cmd == 0x2) { // LC_SYMTAB
+      symOffset = read<uint32_t>(file, command + 8);
+      symCount = read<uint32_t>(file, command + 12);
+      strOffset = read<uint32_t>(file, command + 16);
+    }
+    command += read<uint32_t>(file, command + 4);
+  }
+  if (textIndex == 0 || symOffset == 0) {
+    throw std::runtime_error("no text section or symbol table");
+  }
+
+  // Mach-O has no symbol sizes, a function ends where the next symbol starts.
+  struct Symbol {
+    std::string name;
+    uint64_t address;
+  };
+  std::vector<Symbol> symbols;
+  std::vector<std::string> names;
+  for (uint32_t i = 0; i < symCount; i++) {
+    uint64_t entry = symOffset + i * 16;
+    // C symbols get an underscore prepended.
+    std::string name = readString(file, strOffset + read<uint32_t>(file, entry));
+    if (!name.empty() && name[0] == '_') {
+      name.erase(0, 1);
+    }
+    names.push_back(name);
+    if (read<uint8_t>(file, entry + 5) == textIndex) {
+      symbols.push_back({name, read<uint64_t>(file, entry + 8) - textAddr});
+    }
+  }
+  std::sort(symbols.begin(), symbols.end(),
+            [](const Symbol &a, const Symbol &b) {
+              return a.address < b.address;
+            });
+
+  std::vector<Function> functions;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (!isStencil(symbols[i].name)) {
+      continue;
+    }
+    uint64_t start = symbols[i].address;
+    uint64_t end = textSize;
+    for (size_t j = i + 1; j < symbols.size(); j++) {
+      if (symbols[j].address > start) {
+        end = symbols[j].address;
+        break;
+      }
+    }
+    Function function;
+    function.name = symbols[i].name;
+    function.code.assign(file.begin() + textOffset + start,
+                         file.begin() + textOffset + end);
+    int64_t addend = 0;
+    for (uint32_t k = 0; k < relCount; k++) {
+      uint32_t at = read<uint32_t>(file, relOffset + k * 8);
+      uint32_t info = read<uint32_t>(file, relOffset + k * 8 + 4);
+      uint32_t symbolnum = info & 0xffffff;
+      bool external = (info >> 27) & 1;
+      uint32_t type = info >> 28;
+      // ARM64_RELOC_ADDEND carries the addend of the relocation after it.
+      if (type == 10) {
+        addend = static_cast<int32_t>(symbolnum << 8) >> 8;
+        continue;
+      }
+      if (at < start || at >= end) {
+        addend = 0;
+        continue;
+      }
+      if (!external) {
+        throw std::runtime_error("unsupported section relocation");
+      }
+      Relocation relocation;
+      switch (type) {
+        case 0: relocation = {0, HoleKind::Abs64, false, 0, ""}; break;
+        case 2: relocation = {0, HoleKind::Branch26, false, 0, ""}; break;
+        case 5: relocation = {0, HoleKind::Page21, true, 0, ""}; break;
+        case 6: relocation = {0, HoleKind::PageOff12, true, 0, ""}; break;
+        default:
+          throw std::runtime_error("unsupported Mach-O relocation "
+                                   + std::to_string(type));
+      }
+      relocation.offset = at - start;
+      relocation.addend = addend;
+      relocation.symbol = names.at(symbolnum);
+      function.relocations.push_back(relocation);
+      addend = 0;
+    }
+    functions.push_back(function);
+  }
+  return functions;
+}
+
+// Maps a symbol to the value the hole gets filled with.
+static HoleValue holeValue(const std::string &symbol) {
+  if (symbol == "_JIT_CONTINUE") return HoleValue::Continue;
+  if (symbol == "_JIT_TARGET") return HoleValue::Target;
+  if (symbol == "_JIT_DELTA") return HoleValue::Delta;
+  if (symbol == "_JIT_LIMIT") return HoleValue::Limit;
+  if (symbol == "_JIT_POSITION") return HoleValue::Position;
+  if (symbol == "_JIT_WRITE") return HoleValue::Write;
+  if (symbol == "_JIT_READ") return HoleValue::Read;
+  throw std::runtime_error("unknown hole " + symbol);
+}
+
+// If the stencil ends in a jump to the next one, that jump can go.
+static void elideContinue(Function &function, StencilArch arch) {
+  if (function.relocations.empty()) {
+    return;
+  }
+  const Relocation &last = function.relocations.back();
+  size_t size = function.code.size();
+  if (last.symbol != "_JIT_CONTINUE" || last.got) {
+    return;
+  }
+  size_t cut = 0;
+  if (arch == StencilArch::X86_64 && last.kind == HoleKind::Rel32
+      && last.offset + 4 == size && size >= 5
+      && function.code[size - 5] == 0xe9) { // jmp rel32
+    cut = 5;
+  } else if (arch == StencilArch::AArch64 && last.kind == HoleKind::Branch26
+             && last.offset + 4 == size
+             && (function.code[size - 1] & 0xfc) == 0x14) { // b, not bl
+    cut = 4;
+  }
+  if (cut != 0) {
+    function.code.resize(size - cut);
+    function.relocations.pop_back();
+  }
+}
+
+static std::string upper(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(),
+                 [](unsigned char c) { return std::toupper(c); });
+  return name;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "stencilgen: please provide the stencil object" << std::endl;
+    return 1;
+  }
+  std::ifstream in(argv[1], std::ios::binary);
+  std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+  try {
+    StencilArch arch;
+    std::vector<Function> functions;
+    if (read<uint32_t>(file, 0) == 0x464c457f) { // \x7fELF
+      functions = readElf(file, arch);
+    } else if (read<uint32_t>(file, 0) == 0xfeedfacf) {
+      functions = readMachO(file, arch);
+    } else {
+      throw std::runtime_error("unknown object file format");
+    }
+
+    std::cout << "// Generated by stencilgen from " << argv[1]
+              << ", do not edit.\n\n";
+    std::cout << "constexpr StencilArch STENCIL_ARCH = StencilArch::"
+              << (arch == StencilArch::X86_64 ? "X86_64" : "AArch64")
+              << ";\n";
+    for (Function &function : functions) {
+      std::sort(function.relocations.begin(), function.relocations.end(),
+                [](const Relocation &a, const Relocation &b) {
+                  return a.offset < b.offset;
+                });
+      elideContinue(function, arch);
+      std::string name = upper(function.name);
+      // Empty arrays are not allowed, so both arrays get one unused entry.
+      std::cout << "\nstatic const uint8_t " << name << "_CODE[] = {";
+      for (size_t i = 0; i < function.code.size(); i++) {
+        std::cout << (i % 12 == 0 ? "\n  " : " ")
+                  << static_cast<int>(function.code[i]) << ",";
+      }
+      std::cout << "\n  0,\n};\n";
+      std::cout << "static const Hole " << name << "_HOLES[] = {\n";
+      for (const Relocation &relocation : function.relocations) {
+        std::cout << "  {" << relocation.offset << ", HoleKind("
+                  << static_cast<int>(relocation.kind) << "), HoleValue("
+                  << static_cast<int>(holeValue(relocation.symbol)) << "), "
+                  << (relocation.got ? "true" : "false") << ", "
+                  << relocation.addend << "},\n";
+      }
+      std::cout << "  {0, HoleKind::Abs64, HoleValue::Continue, false, 0},\n";
+      std::cout << "};\n";
+      std::cout << "static const Stencil " << name << " = {" << name
+                << "_CODE, " << function.code.size() << ", " << name
+                << "_HOLES, " << function.relocations.size() << "};\n";
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << "stencilgen: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The stencils of the copy-and-patch backend.
+// These are not linked into the JIT. Instead, they are compiled to an object
+// file at build time, from which stencilgen extracts the code and holes.
+// Every stencil tail calls the next, such that the copies form a chain.
+
+#include <cstdint>
+#include <sys/types.h>
+#include "constants.hpp"
+#include "context.hpp"
+
+// The holes, the names are what stencilgen looks for.
+extern "C" int _JIT_CONTINUE(uint8_t* memory, Context* context, uint8_t* p);
+extern "C" int _JIT_TARGET(uint8_t* memory, Context* context, uint8_t* p);
+extern "C" char _JIT_DELTA[];
+extern "C" char _JIT_LIMIT[];
+extern "C" char _JIT_POSITION[];
+extern "C" ssize_t _JIT_WRITE(int fd, const void* buf, size_t count);
+extern "C" ssize_t _JIT_READ(int fd, void* buf, size_t count);
+
+// The address of a constant hole is the constant itself.
+#define DELTA reinterpret_cast<intptr_t>(_JIT_DELTA)
+#define LIMIT reinterpret_cast<uintptr_t>(_JIT_LIMIT)
+#define POSITION reinterpret_cast<uintptr_t>(_JIT_POSITION)
+
+// Tail calls are what makes the chain, so insist on them where possible.
+#if defined(__clang__)
+#define JUMP(to) [[clang::musttail]] return to(memory, context, p)
+#else
+#define JUMP(to) return to(memory, context, p)
+#endif
+
+#define STENCIL(name)                                                     \
+extern "C" int stencil_##name(uint8_t* memory, Context* context, uint8_t* p)
+
+STENCIL(add_cell) {
+  *p += static_cast<uint8_t>(DELTA);
+  JUMP(_JIT_CONTINUE);
+}
+
+STENCIL(move_pointer) {
+  p += DELTA;
+  JUMP(_JIT_CONTINUE);
+}
+
+STENCIL(clear_cell) {
+  *p = 0;
+  JUMP(_JIT_CONTINUE);
+}
+
+// Skips past the loop if the cell is zero.
+STENCIL(loop_start) {
+  if (*p == 0) {
+    JUMP(_JIT_TARGET);
+  }
+  JUMP(_JIT_CONTINUE);
+}
+
+// Goes back into the loop if the cell is not zero.
+STENCIL(loop_end) {
+  if (__builtin_expect(*p != 0, true)) {
+    JUMP(_JIT_TARGET);
+  }
+  JUMP(_JIT_CONTINUE);
+}
+
+// Aborts unless p + DELTA up to p + DELTA + MEMORY_SIZE - LIMIT are in bounds.
+STENCIL(guard) {
+  if (static_cast<uintptr_t>(p - memory + DELTA) >= LIMIT) {
+    return EXIT_OUT_OF_BOUNDS;
+  }
+  JUMP(_JIT_CONTINUE);
+}
+
+// Charges a loop iteration, before the ] test. Out of fuel, it records where
+// and leaves, such that entering again continues with the test.
+STENCIL(fuel) {
+  context->fuel -= DELTA;
+  if (__builtin_expect(context->fuel < 0, false)) {
+    context->position = POSITION;
+    context->pointer = p - memory;
+    context->resume = reinterpret_cast<uintptr_t>(&_JIT_CONTINUE);
+    return EXIT_OUT_OF_FUEL;
+  }
+  JUMP(_JIT_CONTINUE);
+}
+
+// The start of the chain, which goes back to where the fuel ran out.
+STENCIL(enter) {
+  if (context->resume != 0) {
+    JitFunction resume = reinterpret_cast<JitFunction>(context->resume);
+#if defined(__clang__)
+    [[clang::musttail]]
+#endif
+    return resume(memory, context, p);
+  }
+  JUMP(_JIT_CONTINUE);
+}
+
+STENCIL(output) {
+  _JIT_WRITE(context->outFd, p, 1);
+  JUMP(_JIT_CONTINUE);
+}
+
+STENCIL(input) {
+  _JIT_READ(context->inFd, p, 1);
+  JUMP(_JIT_CONTINUE);
+}
+
+STENCIL(output_counted) {
+  context->bytesWritten += _JIT_WRITE(context->outFd, p, 1);
+  JUMP(_JIT_CONTINUE);
+}
+
+STENCIL(input_counted) {
+  context->bytesRead += _JIT_READ(context->inFd, p, 1);
+  JUMP(_JIT_CONTINUE);
+}
+
+// The end of the chain returns to the host.
+STENCIL(exit) {
+  return 0;
+}
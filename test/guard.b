@@ -0,0 +1,4 @@
+Prints A from inside a loop and only then steps off the start of the tape
+so with safe the A comes out before the program stops with exit code 2
+
+++++++++[>++++++++<-]>+[.[-]]<<+
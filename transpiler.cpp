@@ -0,0 +1,142 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "constants.hpp"
+#include "transpiler.hpp"
+
+Transpiler::Transpiler(int64_t fuel) : _offset(0), _depth(1), _fuel(fuel) {}
+
+void Transpiler::line(const std::string &text) {
+  _source.append(_depth * 2, ' ');
+  _source += text;
+  _source += '\n';
+}
+
+void Transpiler::flushOffset() {
+  if (_offset == 0) {
+    return;
+  }
+  line("p += " + std::to_string(_offset) + ";");
+  _offset = 0;
+}
+
+std::string Transpiler::cell(int64_t offset) const {
+  return "p[" + std::to_string(_offset + offset) + "]";
+}
+
+void Transpiler::prelude() {
+  _source += "#include <stdint.h>\n";
+  _source += "#include <stdio.h>\n";
+  _source += "#include <string.h>\n\n";
+  // Same memory as the JIT, zeroed since it is static.
+  _source += "static uint8_t memory[" + std::to_string(MEMORY_SIZE) + "];\n\n";
+  _source += "int main(void) {\n";
+  line("uint8_t* p = memory;");
+  if (_fuel > 0) {
+    line("int64_t fuel = " + std::to_string(_fuel) + ";");
+  }
+}
+
+void Transpiler::postlude() {
+  line("return 0;");
+  _source += "}\n";
+}
+
+void Transpiler::updateCells(const std::vector<CellUpdate> &cells) {
+  // The C compiler merges adjacent cells itself, but not into a memset.
+  size_t i = 0;
+  while (i < cells.size()) {
+    size_t zeros = zeroRun(cells, i);
+    if (zeros >= VECTOR_CELLS) {
+      line("memset(p + " + std::to_string(_offset + cells[i].offset)
+           + ", 0, " + std::to_string(zeros) + ");");
+      i += zeros;
+      continue;
+    }
+    const CellUpdate &update = cells[i];
+    int8_t value = static_cast<int8_t>(update.value);
+    if (update.set) {
+      line(cell(update.offset) + " = " + std::to_string(update.value) + ";");
+    } else {
+      line(cell(update.offset) + " += " + std::to_string(value) + ";");
+    }
+    i++;
+  }
+}
+
+void Transpiler::movePointer(int64_t delta) {
+  _offset += delta;
+}
+
+void Transpiler::guard(const Guard &range) {
+  line("if ((size_t)(p - memory + " + std::to_string(_offset + range.low)
+       + ") >= " + std::to_string(guardLimit(range)) + ") {");
+  line("  fputs(\"zero: memory access out of bounds\\n\", stderr);");
+  line("  return " + std::to_string(EXIT_OUT_OF_BOUNDS) + ";");
+  line("}");
+}
+
+size_t Transpiler::loopStart(const Guard* once) {
+  // The condition is checked at the same pointer each iteration.
+  flushOffset();
+  _guarded.push_back(once != nullptr);
+  // A guard on entry goes between the first check and the body.
+  if (once != nullptr) {
+    line("if (*p) {");
+    _depth++;
+    guard(*once);
+    line("do {");
+  } else {
+    line("while (*p) {");
+  }
+  _depth++;
+  return _guarded.size() - 1;
+}
+
+void Transpiler::chargeFuel(uint64_t cost, uint64_t position) {
+  // Without a host there is nothing to resume, so only report where.
+  if (_fuel <= 0) {
+    return;
+  }
+  line("if ((fuel -= " + std::to_string(cost) + ") < 0) {");
+  line("  fprintf(stderr, \"zero: out of fuel at position "
+       + std::to_string(position) + ", pointer %ld, cell %d\\n\", "
+       + "(long)(p - memory + " + std::to_string(_offset) + "), "
+       + cell() + ");");
+  line("  return " + std::to_string(EXIT_OUT_OF_FUEL) + ";");
+  line("}");
+}
+
+void Transpiler::loopEnd(size_t loop) {
+  flushOffset();
+  _depth--;
+  if (_guarded[loop]) {
+    line("} while (*p);");
+    _depth--;
+  }
+  line("}");
+}
+
+void Transpiler::output() {
+  line("putchar(" + cell() + ");");
+}
+
+void Transpiler::input() {
+  // Like the JIT, leave the cell alone on end of input.
+  line("{ int c = getchar(); if (c != EOF) " + cell() + " = (uint8_t)c; }");
+}
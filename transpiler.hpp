@@ -0,0 +1,76 @@
+/*
+ * zero.bf, a Brainfuck JIT compiler and interpreter.
+ * Copyright (C) 2025 Paul Hübner
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef transpiler_hpp
+#define transpiler_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "analysis.hpp"
+#include "cells.hpp"
+
+// A compiler backend that writes a self-contained C program instead of
+// machine code, such that clang can optimize it offline.
+class Transpiler {
+private:
+  std::string _source;
+  // How far the pointer moved since the last time it was written back.
+  // Accesses are relative to the pointer so moves are mostly free.
+  int64_t _offset;
+  size_t _depth;
+  // Per loop: whether it was opened as a do-while behind an if.
+  std::vector<bool> _guarded;
+  // The budget baked into the program, or zero for none.
+  int64_t _fuel;
+
+  // Writes a line at the current indentation.
+  void line(const std::string &text);
+
+  // Writes the pending offset back into the pointer.
+  void flushOffset();
+
+  // A cell at an offset from the current one, relative to the pointer.
+  std::string cell(int64_t offset = 0) const;
+
+public:
+  Transpiler(int64_t fuel = 0);
+
+  // The program so far.
+  inline const std::string& source() const {
+    return _source;
+  }
+
+  // The code before the program: includes, memory and entry point.
+  void prelude();
+
+  // The code after the program.
+  void postlude();
+
+  void updateCells(const std::vector<CellUpdate> &cells);
+  void movePointer(int64_t delta);
+  void guard(const Guard &range);
+  size_t loopStart(const Guard* once = nullptr);
+  void chargeFuel(uint64_t cost, uint64_t position);
+  void loopEnd(size_t start);
+  void output();
+  void input();
+};
+
+#endif